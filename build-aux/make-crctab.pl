@@ -17,6 +17,23 @@
 #
 
 use Text::Wrap;
+
+# crc_table[b] is the CRC of byte b.  For slicing-by-8 CRC computation
+# crc_slice_table[k][b] is the CRC of byte b followed by k zero bytes,
+# so that 8 input bytes can be folded into the CRC with 8 table lookups.
+@t = map {
+  $c = $_<<24;
+  for (1..8) { $c = ($c<<1) & 0xFFFFFFFF ^ 0x04C11DB7 & -($c>>31); }
+  $c
+} 0..255;
+@s = ([@t]);
+for $k (1..7) {
+  push @s, [map { ($s[$k-1][$_]<<8) & 0xFFFFFFFF ^ $t[$s[$k-1][$_]>>24] }
+            0..255];
+}
+
+sub table { wrap '  ','  ',map { sprintf "0x%08lX,",$_ } @_ }
+
 open F, ">src/crctab.c" or die;
 printf F q(/* This file was generated automatically by make-crctab.pl.
    For comments refer to the generator script -- make-crctab.pl. */
@@ -26,8 +43,8 @@ printf F q(/* This file was generated automatically by make-crctab.pl.
 uint32_t crc_table[256] = {
 %s
 };
-), wrap '  ','  ',map {
-  $c = $_<<24;
-  for (1..8) { $c = ($c<<1) & 0xFFFFFFFF ^ 0x04C11DB7 & -($c>>31); }
-  sprintf "0x%08lX,",$c
-} 0..255
+
+uint32_t crc_slice_table[8][256] = { {
+%s
+} };
+), table(@t), join "\n}, {\n", map { table(@$_) } @s;
@@ -71,7 +71,7 @@ print F;
 
 __END__
 Usage:
-1. PROG [-n WTHRS] [-k|-c|-t] [-d|-z] [-1 .. -9] [-f] [-v] [-S] {FILE}
+1. PROG [-n WTHRS] [-k|-c|-t] [-d|-z] [-1 .. -9] [-f] [-r] [-v] [-S] {FILE}
 2. PROG -h|-V
 
 Recognized PROG names:
@@ -137,6 +137,24 @@ Reduce memory usage at cost of performance.
 Perform splitting input blocks sequentially. This may improve compression ratio
 and decrease CPU usage, but will degrade scalability.
 
+@--dedup
+Reuse compressed blocks for repeated identical input blocks. This may speed up
+compression of data containing large duplicated regions.
+
+@--stream-blocks=N
+When compressing, write a separate bzip2 stream for every N blocks, where N is
+a positive integer. This allows other tools to split output and decompress
+parts of it in parallel.
+
+@-r, --recursive
+Process all regular files in directories given as FILE operands, and in their
+subdirectories. Files are processed as with `--parallel-files', largest first.
+
+@--parallel-files
+Process several FILE operands at the same time, sharing the worker threads
+among them. This speeds up processing of many small files. Ignored with `-c',
+`--dedup' and `--stream-blocks'.
+
 @-v, --verbose
 Log each (de)compression start to stderr. Display compression ratio and space
 savings. Display progress information if stderr is connected to a terminal.
@@ -144,6 +162,15 @@ savings. Display progress information if stderr is connected to a terminal.
 @-S
 Print condition variable statistics to stderr.
 
+@--stats=json
+After each file and at the end of the run, print statistics as a JSON object
+on a line of its own to stderr: bytes, blocks, CPU time of each stage, queue
+high-water marks, stall counts and wall time.
+
+@--trace=FILE
+Record the start and end time of every task run by worker threads, and of
+every read and write, and save them to FILE in Chrome trace event format.
+
 @-q, --quiet, --repetitive-fast, --repetitive-best, --exponential
 Accepted for compatibility, otherwise ignored.
 
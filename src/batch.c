@@ -0,0 +1,252 @@
+/*-
+  batch.c -- parallel processing of multiple files
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+#include <pthread.h>            /* pthread_create() */
+#include <signal.h>             /* SIGUSR2 */
+#include <sys/stat.h>           /* struct stat */
+
+#include "liblbzip2.h"          /* lbzip2_push() */
+#include "signals.h"            /* halt() */
+#include "main.h"               /* input_init() */
+
+
+/*
+  With --parallel-files, FILE operands are processed by a number of file
+  driver threads at the same time.  Each driver takes the next operand, opens
+  its input and output just like the sequential loop in main() does, and
+  moves data between the files and a liblbzip2 context.  All contexts share a
+  single pool of worker threads, which gives priority to the files that were
+  started first.  When a file has no more blocks to offer, idle workers take
+  up blocks of the files after it, so the tail of one file overlaps the head
+  of the next one.
+
+  The process.c scheduler can't be used for that, because it keeps all of its
+  state in file-scope variables and runs only one file at a time.
+
+  The main thread waits in halt(), exactly as it does in work().  The last
+  driver to finish sends SIGUSR2; errors are handled by bailout(), which
+  removes all output files being written.
+*/
+
+
+#define xjoin(t)      ((void)(pthread_join((t), NULL)    && (abort(), 0)))
+#define xlock(m)      ((void)(pthread_mutex_lock(m)      && (abort(), 0)))
+#define xunlock(m)    ((void)(pthread_mutex_unlock(m)    && (abort(), 0)))
+
+/* Size of input and output buffers of each driver. */
+#define BUF_SIZE (1u << 20)
+
+
+struct driver {
+  pthread_t thread;
+  char **opathn;                /* output file being written */
+  uint8_t *ibuf;
+  uint8_t *obuf;
+};
+
+static struct lbzip2_pool *pool;
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct arg *next_operand; /* next operand to process */
+static unsigned running;        /* number of drivers still running */
+
+
+/* Push all of the input to "ctx" and write all of its output. */
+static void
+transfer(struct driver *drv, struct lbzip2_ctx *ctx, struct filespec *is,
+         struct filespec *os)
+{
+  const uint8_t *p = NULL;
+  size_t avail = 0u;
+  size_t size;
+  size_t vacant;
+  bool first = true;
+  bool eof = false;
+  bool finished = false;
+  int rv;
+
+  for (;;) {
+    if (avail == 0u && !eof) {
+      vacant = BUF_SIZE;
+      fs_read(is, drv->ibuf, &vacant);
+      avail = BUF_SIZE - vacant;
+      p = drv->ibuf;
+      eof = vacant > 0u;
+
+      /* Check the first stream header, as work() does. */
+      if (decompress && first
+          && (avail < 4u || p[0] != 0x42 || p[1] != 0x5A || p[2] != 0x68
+              || p[3] < 0x31 || p[3] > 0x39)) {
+        failf(is, "not a valid bzip2 file");
+      }
+      first = false;
+    }
+
+    if (avail > 0u) {
+      size = avail;
+      rv = lbzip2_push(ctx, p, &size);
+      if (rv < 0) {
+        failf(is, "lbzip2_push() failed with code %d", rv);
+      }
+      p += size;
+      avail -= size;
+    }
+
+    if (eof && avail == 0u && !finished) {
+      rv = lbzip2_finish(ctx);
+      if (rv < 0) {
+        failf(is, "lbzip2_finish() failed with code %d", rv);
+      }
+      finished = true;
+    }
+
+    do {
+      size = BUF_SIZE;
+      rv = lbzip2_pull(ctx, drv->obuf, &size);
+      if (rv < 0) {
+        failf(is, "compressed data error: %s", lbzip2_error(ctx));
+      }
+      fs_write(os, drv->obuf, size);
+    }
+    while (rv == LBZIP2_OK && size > 0u);
+
+    if (rv == LBZIP2_END)
+      break;
+  }
+}
+
+
+static void
+work_file(struct driver *drv, const struct arg *operand)
+{
+  struct filespec is, os;
+  struct stat sbuf;
+  struct lbzip2_ctx *ctx;
+
+  if (-1 == input_init(&is, operand, &sbuf)) {
+    return;
+  }
+
+  if (-1 != output_init(&os, drv->opathn, operand, &sbuf)) {
+    if (verbose) {
+      info(decompress ? "decompressing %s%s%s to %s%s%s" :
+           "compressing %s%s%s to %s%s%s", is.sep, is.fmt, is.sep,
+           os.sep, os.fmt, os.sep);
+    }
+
+    ctx = decompress ? lbzip2_decompress_init_pool(pool) :
+        lbzip2_compress_init_pool(pool, bs100k);
+    transfer(drv, ctx, &is, &os);
+    lbzip2_close(ctx);
+
+    output_uninit(&os, drv->opathn, operand, &sbuf);
+
+    if (verbose && 0u < is.total && 0u < os.total) {
+      report_ratio(&is, &os);
+    }
+  }
+
+  input_uninit(&is);
+}
+
+
+static void *
+driver_thread(void *arg)
+{
+  struct driver *drv = arg;
+  struct arg *operand;
+
+  for (;;) {
+    xlock(&batch_mutex);
+    operand = next_operand;
+    if (operand != NULL)
+      next_operand = operand->next;
+    xunlock(&batch_mutex);
+
+    if (operand == NULL)
+      break;
+
+    work_file(drv, operand);
+    free(operand);
+  }
+
+  xlock(&batch_mutex);
+  if (--running == 0u)
+    xraise(SIGUSR2);
+  xunlock(&batch_mutex);
+
+  return NULL;
+}
+
+
+void
+work_files(struct arg *operands)
+{
+  struct driver *drivers;
+  struct arg *arg;
+  char **slots;
+  unsigned num_drivers;
+  unsigned i;
+  int err;
+
+  /* One driver per worker is enough to keep all workers busy even if every
+     file has only a single block. */
+  num_drivers = 0u;
+  for (arg = operands; arg != NULL && num_drivers < num_worker;
+       arg = arg->next)
+    ++num_drivers;
+
+  slots = opathn_slots(num_drivers);
+  drivers = XNMALLOC(num_drivers, struct driver);
+  next_operand = operands;
+  running = num_drivers;
+
+  /* Threads inherit the signal mask, so everything is created after signals
+     have been blocked; only the main thread receives them, in halt(). */
+  cli();
+
+  pool = lbzip2_pool_create(num_worker);
+
+  for (i = 0u; i < num_drivers; ++i) {
+    drivers[i].opathn = &slots[i];
+    drivers[i].ibuf = xmalloc(BUF_SIZE);
+    drivers[i].obuf = xmalloc(BUF_SIZE);
+
+    err = pthread_create(&drivers[i].thread, NULL, driver_thread,
+                         &drivers[i]);
+    if (err != 0)
+      failx(err, "unable to create a POSIX thread");
+  }
+
+  halt();
+
+  for (i = 0u; i < num_drivers; ++i) {
+    xjoin(drivers[i].thread);
+    free(drivers[i].ibuf);
+    free(drivers[i].obuf);
+  }
+
+  lbzip2_pool_destroy(pool);
+  sti();
+
+  free(drivers);
+}
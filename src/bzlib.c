@@ -0,0 +1,829 @@
+/*-
+  bzlib.c -- libbz2-compatible interface to liblbzip2
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+#include <stdio.h>              /* fread() */
+#include <string.h>             /* memcpy() */
+
+#include "main.h"               /* xmalloc() */
+#include "liblbzip2.h"          /* lbzip2_push() */
+
+#include "bzlib.h"              /* bz_stream */
+
+
+/*
+  Differences from libbz2 that callers may notice:
+
+  - Concatenated bzip2 streams are decompressed as one, like lbzip2 does.
+    BZ2_bzDecompress() returns BZ_STREAM_END once the input passed to it so
+    far ends on a stream boundary and all output has been produced; bytes
+    following the last stream are consumed.
+
+  - Compressed output may be produced later than libbz2 would, because blocks
+    are compressed in parallel.  Decompressed output is always produced
+    before BZ2_bzDecompress() returns with input exhausted, as callers
+    expect.  Decompression can therefore be parallel only if callers pass
+    several blocks of input at once; the stdio interface reads large chunks
+    of input itself.
+
+  - bzalloc and bzfree are not used.  Verbosity is ignored.
+*/
+
+
+/* Size of stdio interface buffers. */
+#define FILE_BUFFER (1u << 20)
+
+/* Returned by transfer() when output buffer is full. */
+#define OUTPUT_FULL 2
+
+
+enum stage {
+  RUNNING,
+  FLUSHING,
+  FINISHING,
+  DONE,
+};
+
+struct bz_state {
+  bz_stream *strm;              /* owning stream, used for sanity checks */
+  struct lbzip2_ctx *ctx;
+  bool decompress;
+  enum stage stage;
+  bool flushed;                 /* lbzip2_flush() called since last push */
+  bool finished;                /* lbzip2_finish() was called */
+};
+
+
+static void
+add_total(unsigned int *lo32, unsigned int *hi32, size_t n)
+{
+  uint64_t total = ((uint64_t)*hi32 << 32) + *lo32 + n;
+
+  *lo32 = (unsigned int)total;
+  *hi32 = (unsigned int)(total >> 32);
+}
+
+static struct bz_state *
+get_state(bz_stream *strm, bool decompress)
+{
+  struct bz_state *s;
+
+  if (strm == NULL)
+    return NULL;
+  s = strm->state;
+  if (s == NULL || s->strm != strm || s->decompress != decompress)
+    return NULL;
+
+  return s;
+}
+
+static int
+init_state(bz_stream *strm, bool decompress, struct lbzip2_ctx *ctx)
+{
+  struct bz_state *s;
+
+  if (ctx == NULL)
+    return BZ_PARAM_ERROR;
+
+  s = XMALLOC(struct bz_state);
+  s->strm = strm;
+  s->ctx = ctx;
+  s->decompress = decompress;
+  s->stage = RUNNING;
+  s->flushed = false;
+  s->finished = false;
+
+  strm->state = s;
+  strm->total_in_lo32 = 0;
+  strm->total_in_hi32 = 0;
+  strm->total_out_lo32 = 0;
+  strm->total_out_hi32 = 0;
+
+  return BZ_OK;
+}
+
+static int
+end_state(bz_stream *strm, bool decompress)
+{
+  struct bz_state *s = get_state(strm, decompress);
+
+  if (s == NULL)
+    return BZ_PARAM_ERROR;
+
+  lbzip2_close(s->ctx);
+  free(s);
+  strm->state = NULL;
+
+  return BZ_OK;
+}
+
+
+/* Push as much input as the engine accepts and pull whatever output is
+   ready, until input is exhausted and no more output is ready, or output
+   buffer is full.  Return OUTPUT_FULL or the status of the last pull.
+
+   With DRAIN, wait for all output that can be produced from the input.
+   Callers of libbz2 assume that once all input is consumed, all output has
+   been produced, unless output buffer was filled -- libbz2 can't consume
+   the stream trailer before it outputs the last block.  So the last input
+   byte is held back until all output preceding it has been pulled. */
+static int
+transfer(struct bz_state *s, bool drain)
+{
+  bz_stream *strm = s->strm;
+  unsigned int hold = drain;
+  size_t n;
+  int rv;
+
+  for (;;) {
+    if (strm->avail_in > hold) {
+      n = strm->avail_in - hold;
+      rv = lbzip2_push(s->ctx, strm->next_in, &n);
+      if (rv != LBZIP2_OK)
+        return rv;
+      strm->next_in += n;
+      strm->avail_in -= n;
+      add_total(&strm->total_in_lo32, &strm->total_in_hi32, n);
+      if (n > 0)
+        s->flushed = false;
+    }
+
+    if (drain && strm->avail_in <= hold && !s->flushed) {
+      lbzip2_flush(s->ctx);
+      s->flushed = true;
+    }
+
+    if (strm->avail_out == 0)
+      return OUTPUT_FULL;
+
+    n = strm->avail_out;
+    rv = lbzip2_pull(s->ctx, strm->next_out, &n);
+    strm->next_out += n;
+    strm->avail_out -= n;
+    add_total(&strm->total_out_lo32, &strm->total_out_hi32, n);
+
+    if (rv != LBZIP2_OK)
+      return rv;
+    if (n == 0 && strm->avail_in <= hold) {
+      if (strm->avail_in == 0)
+        return LBZIP2_OK;
+      hold = 0;
+    }
+  }
+}
+
+static int
+map_error(int rv)
+{
+  switch (rv) {
+  case LBZIP2_EMAGIC:
+    return BZ_DATA_ERROR_MAGIC;
+  case LBZIP2_EEOF:
+    return BZ_UNEXPECTED_EOF;
+  case LBZIP2_EDATA:
+    return BZ_DATA_ERROR;
+  default:
+    return BZ_SEQUENCE_ERROR;
+  }
+}
+
+
+int
+BZ2_bzCompressInit(bz_stream *strm, int blockSize100k, int verbosity,
+                   int workFactor)
+{
+  (void)verbosity;
+
+  if (strm == NULL || blockSize100k < 1 || blockSize100k > 9 ||
+      workFactor < 0 || workFactor > 250)
+    return BZ_PARAM_ERROR;
+
+  return init_state(strm, false, lbzip2_compress_init(0, blockSize100k));
+}
+
+int
+BZ2_bzCompress(bz_stream *strm, int action)
+{
+  struct bz_state *s = get_state(strm, false);
+  int rv;
+
+  if (s == NULL)
+    return BZ_PARAM_ERROR;
+
+  switch (s->stage) {
+  case RUNNING:
+    if (action == BZ_RUN) {
+      transfer(s, false);
+      return BZ_RUN_OK;
+    }
+    if (action == BZ_FLUSH)
+      s->stage = FLUSHING;
+    else if (action == BZ_FINISH)
+      s->stage = FINISHING;
+    else
+      return BZ_PARAM_ERROR;
+    return BZ2_bzCompress(strm, action);
+
+  case FLUSHING:
+    if (action != BZ_FLUSH)
+      return BZ_SEQUENCE_ERROR;
+    if (transfer(s, true) == OUTPUT_FULL)
+      return BZ_FLUSH_OK;
+    s->stage = RUNNING;
+    return BZ_RUN_OK;
+
+  case FINISHING:
+    if (action != BZ_FINISH)
+      return BZ_SEQUENCE_ERROR;
+    if (transfer(s, false) == OUTPUT_FULL && strm->avail_in > 0)
+      return BZ_FINISH_OK;
+    if (!s->finished) {
+      lbzip2_finish(s->ctx);
+      s->finished = true;
+    }
+    rv = transfer(s, false);
+    if (rv != LBZIP2_END)
+      return BZ_FINISH_OK;
+    s->stage = DONE;
+    return BZ_STREAM_END;
+
+  default:
+    return BZ_SEQUENCE_ERROR;
+  }
+}
+
+int
+BZ2_bzCompressEnd(bz_stream *strm)
+{
+  return end_state(strm, false);
+}
+
+
+int
+BZ2_bzDecompressInit(bz_stream *strm, int verbosity, int small)
+{
+  if (strm == NULL || verbosity < 0 || verbosity > 4 ||
+      (small != 0 && small != 1))
+    return BZ_PARAM_ERROR;
+
+  /* Small mode has to keep memory usage low, so use only one thread. */
+  return init_state(strm, true, lbzip2_decompress_init(small ? 1 : 0));
+}
+
+int
+BZ2_bzDecompress(bz_stream *strm)
+{
+  struct bz_state *s = get_state(strm, true);
+  int rv;
+
+  if (s == NULL)
+    return BZ_PARAM_ERROR;
+  if (s->stage == DONE)
+    return BZ_SEQUENCE_ERROR;
+
+  rv = transfer(s, true);
+
+  if (rv == OUTPUT_FULL)
+    return BZ_OK;
+  if (rv < 0)
+    return map_error(rv);
+  if (rv == LBZIP2_OK && !lbzip2_stream_end(s->ctx))
+    return BZ_OK;
+
+  s->stage = DONE;
+  return BZ_STREAM_END;
+}
+
+int
+BZ2_bzDecompressEnd(bz_stream *strm)
+{
+  return end_state(strm, true);
+}
+
+
+int
+BZ2_bzBuffToBuffCompress(char *dest, unsigned int *destLen, char *source,
+                         unsigned int sourceLen, int blockSize100k,
+                         int verbosity, int workFactor)
+{
+  bz_stream strm;
+  int rv;
+
+  if (dest == NULL || destLen == NULL || source == NULL)
+    return BZ_PARAM_ERROR;
+
+  rv = BZ2_bzCompressInit(&strm, blockSize100k, verbosity, workFactor);
+  if (rv != BZ_OK)
+    return rv;
+
+  strm.next_in = source;
+  strm.avail_in = sourceLen;
+  strm.next_out = dest;
+  strm.avail_out = *destLen;
+
+  rv = BZ2_bzCompress(&strm, BZ_FINISH);
+  *destLen -= strm.avail_out;
+  BZ2_bzCompressEnd(&strm);
+
+  return rv == BZ_STREAM_END ? BZ_OK : BZ_OUTBUFF_FULL;
+}
+
+int
+BZ2_bzBuffToBuffDecompress(char *dest, unsigned int *destLen, char *source,
+                           unsigned int sourceLen, int small, int verbosity)
+{
+  bz_stream strm;
+  int rv;
+
+  if (dest == NULL || destLen == NULL || source == NULL)
+    return BZ_PARAM_ERROR;
+
+  rv = BZ2_bzDecompressInit(&strm, verbosity, small);
+  if (rv != BZ_OK)
+    return rv;
+
+  strm.next_in = source;
+  strm.avail_in = sourceLen;
+  strm.next_out = dest;
+  strm.avail_out = *destLen;
+
+  rv = BZ2_bzDecompress(&strm);
+  *destLen -= strm.avail_out;
+  BZ2_bzDecompressEnd(&strm);
+
+  if (rv == BZ_STREAM_END)
+    return BZ_OK;
+  if (rv == BZ_OK)
+    return strm.avail_out == 0 ? BZ_OUTBUFF_FULL : BZ_UNEXPECTED_EOF;
+  return rv;
+}
+
+
+/*
+  The stdio interface drives the engine directly rather than through
+  bz_stream, so that decompression can read ahead as far as the engine
+  wants.
+*/
+
+struct bzfile {
+  FILE *handle;
+  bool writing;
+  bool finished;                /* lbzip2_finish() was called */
+  bool end;                     /* end of stream reached */
+  int last_err;
+  struct lbzip2_ctx *ctx;
+  uint64_t total_in;
+  uint64_t total_out;
+  size_t pos;                   /* position of unpushed input in buffer */
+  size_t avail;                 /* amount of unpushed input in buffer */
+  char buffer[FILE_BUFFER];
+};
+
+static void
+set_error(int *bzerror, struct bzfile *bzf, int err)
+{
+  if (bzerror != NULL)
+    *bzerror = err;
+  if (bzf != NULL)
+    bzf->last_err = err;
+}
+
+
+BZFILE *
+BZ2_bzReadOpen(int *bzerror, FILE *f, int verbosity, int small, void *unused,
+               int nUnused)
+{
+  struct bzfile *bzf;
+
+  set_error(bzerror, NULL, BZ_OK);
+
+  if (f == NULL || (small != 0 && small != 1) || verbosity < 0 ||
+      verbosity > 4 || (unused == NULL && nUnused != 0) || nUnused < 0 ||
+      nUnused > BZ_MAX_UNUSED) {
+    set_error(bzerror, NULL, BZ_PARAM_ERROR);
+    return NULL;
+  }
+  if (ferror(f)) {
+    set_error(bzerror, NULL, BZ_IO_ERROR);
+    return NULL;
+  }
+
+  bzf = XMALLOC(struct bzfile);
+  bzf->handle = f;
+  bzf->writing = false;
+  bzf->finished = false;
+  bzf->end = false;
+  bzf->last_err = BZ_OK;
+  bzf->ctx = lbzip2_decompress_init(small ? 1 : 0);
+  bzf->total_in = 0;
+  bzf->total_out = 0;
+  bzf->pos = 0;
+  bzf->avail = nUnused;
+  memcpy(bzf->buffer, unused, nUnused);
+
+  return bzf;
+}
+
+void
+BZ2_bzReadClose(int *bzerror, BZFILE *b)
+{
+  struct bzfile *bzf = b;
+
+  set_error(bzerror, bzf, BZ_OK);
+  if (bzf == NULL)
+    return;
+  if (bzf->writing) {
+    set_error(bzerror, bzf, BZ_SEQUENCE_ERROR);
+    return;
+  }
+
+  lbzip2_close(bzf->ctx);
+  free(bzf);
+}
+
+int
+BZ2_bzRead(int *bzerror, BZFILE *b, void *buf, int len)
+{
+  struct bzfile *bzf = b;
+  char *p = buf;
+  size_t n;
+  int rv;
+
+  set_error(bzerror, bzf, BZ_OK);
+
+  if (bzf == NULL || buf == NULL || len < 0) {
+    set_error(bzerror, bzf, BZ_PARAM_ERROR);
+    return 0;
+  }
+  if (bzf->writing) {
+    set_error(bzerror, bzf, BZ_SEQUENCE_ERROR);
+    return 0;
+  }
+  if (bzf->end) {
+    set_error(bzerror, bzf, BZ_STREAM_END);
+    return 0;
+  }
+  if (len == 0)
+    return 0;
+
+  for (;;) {
+    n = len - (p - (char *)buf);
+    rv = lbzip2_pull(bzf->ctx, p, &n);
+    p += n;
+
+    if (rv == LBZIP2_END) {
+      bzf->end = true;
+      set_error(bzerror, bzf, BZ_STREAM_END);
+      break;
+    }
+    if (rv < 0) {
+      set_error(bzerror, bzf, map_error(rv));
+      return 0;
+    }
+    if (p - (char *)buf == len)
+      break;
+    if (n > 0)
+      continue;
+
+    /* The engine needs more input. */
+    if (bzf->avail == 0) {
+      if (!bzf->finished && feof(bzf->handle)) {
+        lbzip2_finish(bzf->ctx);
+        bzf->finished = true;
+        continue;
+      }
+      bzf->pos = 0;
+      bzf->avail = fread(bzf->buffer, 1, FILE_BUFFER, bzf->handle);
+      if (ferror(bzf->handle)) {
+        set_error(bzerror, bzf, BZ_IO_ERROR);
+        return 0;
+      }
+    }
+
+    n = bzf->avail;
+    lbzip2_push(bzf->ctx, bzf->buffer + bzf->pos, &n);
+    bzf->pos += n;
+    bzf->avail -= n;
+    bzf->total_in += n;
+  }
+
+  bzf->total_out += p - (char *)buf;
+  return p - (char *)buf;
+}
+
+void
+BZ2_bzReadGetUnused(int *bzerror, BZFILE *b, void **unused, int *nUnused)
+{
+  struct bzfile *bzf = b;
+
+  if (bzf == NULL || unused == NULL || nUnused == NULL) {
+    set_error(bzerror, bzf, BZ_PARAM_ERROR);
+    return;
+  }
+  if (!bzf->end) {
+    set_error(bzerror, bzf, BZ_SEQUENCE_ERROR);
+    return;
+  }
+
+  /* Callers typically copy unused data to a buffer of BZ_MAX_UNUSED bytes.
+     Data after the last stream is ignored by the engine anyway. */
+  set_error(bzerror, bzf, BZ_OK);
+  *unused = bzf->buffer + bzf->pos;
+  *nUnused = min(bzf->avail, (size_t)BZ_MAX_UNUSED);
+}
+
+
+BZFILE *
+BZ2_bzWriteOpen(int *bzerror, FILE *f, int blockSize100k, int verbosity,
+                int workFactor)
+{
+  struct bzfile *bzf;
+
+  set_error(bzerror, NULL, BZ_OK);
+
+  if (f == NULL || blockSize100k < 1 || blockSize100k > 9 ||
+      workFactor < 0 || workFactor > 250 || verbosity < 0 || verbosity > 4) {
+    set_error(bzerror, NULL, BZ_PARAM_ERROR);
+    return NULL;
+  }
+  if (ferror(f)) {
+    set_error(bzerror, NULL, BZ_IO_ERROR);
+    return NULL;
+  }
+
+  bzf = XMALLOC(struct bzfile);
+  bzf->handle = f;
+  bzf->writing = true;
+  bzf->finished = false;
+  bzf->end = false;
+  bzf->last_err = BZ_OK;
+  bzf->ctx = lbzip2_compress_init(0, blockSize100k);
+  bzf->total_in = 0;
+  bzf->total_out = 0;
+  bzf->pos = 0;
+  bzf->avail = 0;
+
+  return bzf;
+}
+
+/* Write all compressed data that is ready.  Return LBZIP2_END at end of
+   stream, otherwise LBZIP2_OK, or BZ_IO_ERROR on write failure. */
+static int
+write_ready(struct bzfile *bzf)
+{
+  size_t n;
+  int rv;
+
+  do {
+    n = FILE_BUFFER;
+    rv = lbzip2_pull(bzf->ctx, bzf->buffer, &n);
+    if (n > 0 && fwrite(bzf->buffer, 1, n, bzf->handle) != n)
+      return BZ_IO_ERROR;
+    bzf->total_out += n;
+  }
+  while (rv == LBZIP2_OK && n > 0);
+
+  return rv;
+}
+
+void
+BZ2_bzWrite(int *bzerror, BZFILE *b, void *buf, int len)
+{
+  struct bzfile *bzf = b;
+  const char *p = buf;
+  size_t n;
+
+  set_error(bzerror, bzf, BZ_OK);
+
+  if (bzf == NULL || buf == NULL || len < 0) {
+    set_error(bzerror, bzf, BZ_PARAM_ERROR);
+    return;
+  }
+  if (!bzf->writing) {
+    set_error(bzerror, bzf, BZ_SEQUENCE_ERROR);
+    return;
+  }
+  if (ferror(bzf->handle)) {
+    set_error(bzerror, bzf, BZ_IO_ERROR);
+    return;
+  }
+
+  while (len > 0) {
+    n = len;
+    lbzip2_push(bzf->ctx, p, &n);
+    p += n;
+    len -= n;
+    bzf->total_in += n;
+
+    if (write_ready(bzf) == BZ_IO_ERROR) {
+      set_error(bzerror, bzf, BZ_IO_ERROR);
+      return;
+    }
+  }
+}
+
+void
+BZ2_bzWriteClose64(int *bzerror, BZFILE *b, int abandon,
+                   unsigned int *nbytes_in_lo32, unsigned int *nbytes_in_hi32,
+                   unsigned int *nbytes_out_lo32,
+                   unsigned int *nbytes_out_hi32)
+{
+  struct bzfile *bzf = b;
+  int rv;
+
+  set_error(bzerror, bzf, BZ_OK);
+
+  if (bzf == NULL)
+    return;
+  if (!bzf->writing) {
+    set_error(bzerror, bzf, BZ_SEQUENCE_ERROR);
+    return;
+  }
+
+  if (!abandon && !ferror(bzf->handle)) {
+    lbzip2_finish(bzf->ctx);
+    do
+      rv = write_ready(bzf);
+    while (rv == LBZIP2_OK);
+
+    if (rv == BZ_IO_ERROR || fflush(bzf->handle) != 0) {
+      set_error(bzerror, bzf, BZ_IO_ERROR);
+      return;
+    }
+  }
+  else if (ferror(bzf->handle)) {
+    set_error(bzerror, bzf, BZ_IO_ERROR);
+  }
+
+  if (nbytes_in_lo32 != NULL)
+    *nbytes_in_lo32 = (unsigned int)bzf->total_in;
+  if (nbytes_in_hi32 != NULL)
+    *nbytes_in_hi32 = (unsigned int)(bzf->total_in >> 32);
+  if (nbytes_out_lo32 != NULL)
+    *nbytes_out_lo32 = (unsigned int)bzf->total_out;
+  if (nbytes_out_hi32 != NULL)
+    *nbytes_out_hi32 = (unsigned int)(bzf->total_out >> 32);
+
+  lbzip2_close(bzf->ctx);
+  free(bzf);
+}
+
+void
+BZ2_bzWriteClose(int *bzerror, BZFILE *b, int abandon,
+                 unsigned int *nbytes_in, unsigned int *nbytes_out)
+{
+  BZ2_bzWriteClose64(bzerror, b, abandon, nbytes_in, NULL, nbytes_out, NULL);
+}
+
+
+const char *
+BZ2_bzlibVersion(void)
+{
+  return "1.0.8, lbzip2-" PACKAGE_VERSION;
+}
+
+static BZFILE *
+bzopen_or_bzdopen(const char *path, int fd, const char *mode)
+{
+  int err;
+  bool writing = false;
+  int bs100k = 9;
+  int small = 0;
+  FILE *f;
+  BZFILE *bzf;
+
+  if (mode == NULL)
+    return NULL;
+
+  for (; *mode != '\0'; mode++) {
+    if (*mode == 'r')
+      writing = false;
+    else if (*mode == 'w')
+      writing = true;
+    else if (*mode == 's')
+      small = 1;
+    else if (*mode >= '1' && *mode <= '9')
+      bs100k = *mode - '0';
+  }
+
+  if (path == NULL && fd < 0)
+    f = writing ? stdout : stdin;
+  else if (path != NULL)
+    f = *path == '\0' ? (writing ? stdout : stdin) :
+        fopen(path, writing ? "wb" : "rb");
+  else
+    f = fdopen(fd, writing ? "wb" : "rb");
+  if (f == NULL)
+    return NULL;
+
+  if (writing)
+    bzf = BZ2_bzWriteOpen(&err, f, bs100k, 0, 30);
+  else
+    bzf = BZ2_bzReadOpen(&err, f, 0, small, NULL, 0);
+
+  if (bzf == NULL && f != stdin && f != stdout)
+    fclose(f);
+
+  return bzf;
+}
+
+BZFILE *
+BZ2_bzopen(const char *path, const char *mode)
+{
+  return bzopen_or_bzdopen(path != NULL ? path : "", -1, mode);
+}
+
+BZFILE *
+BZ2_bzdopen(int fd, const char *mode)
+{
+  return bzopen_or_bzdopen(NULL, fd, mode);
+}
+
+int
+BZ2_bzread(BZFILE *b, void *buf, int len)
+{
+  int err;
+  int n;
+
+  if (((struct bzfile *)b)->last_err == BZ_STREAM_END)
+    return 0;
+
+  n = BZ2_bzRead(&err, b, buf, len);
+  return err == BZ_OK || err == BZ_STREAM_END ? n : -1;
+}
+
+int
+BZ2_bzwrite(BZFILE *b, void *buf, int len)
+{
+  int err;
+
+  BZ2_bzWrite(&err, b, buf, len);
+  return err == BZ_OK ? len : -1;
+}
+
+int
+BZ2_bzflush(BZFILE *b)
+{
+  (void)b;
+  return 0;
+}
+
+void
+BZ2_bzclose(BZFILE *b)
+{
+  struct bzfile *bzf = b;
+  FILE *f;
+  int err;
+
+  if (bzf == NULL)
+    return;
+
+  f = bzf->handle;
+  if (bzf->writing) {
+    BZ2_bzWriteClose(&err, b, false, NULL, NULL);
+    if (err != BZ_OK)
+      BZ2_bzWriteClose(NULL, b, true, NULL, NULL);
+  }
+  else {
+    BZ2_bzReadClose(&err, b);
+  }
+
+  if (f != stdin && f != stdout)
+    fclose(f);
+}
+
+const char *
+BZ2_bzerror(BZFILE *b, int *errnum)
+{
+  static const char *table[] = {
+    "OK", "SEQUENCE_ERROR", "PARAM_ERROR", "MEM_ERROR", "DATA_ERROR",
+    "DATA_ERROR_MAGIC", "IO_ERROR", "UNEXPECTED_EOF", "OUTBUFF_FULL",
+    "CONFIG_ERROR",
+  };
+  int err = ((struct bzfile *)b)->last_err;
+
+  if (err > 0)
+    err = 0;
+  *errnum = err;
+
+  return table[-err];
+}
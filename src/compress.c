@@ -22,13 +22,52 @@
 
 #include "common.h"
 
-#include "main.h"               /* bs100k */
+#include <string.h>             /* memcpy() */
+
+#include "main.h"               /* bs100k, blocks_per_stream */
 #include "encode.h"             /* encode() */
 #include "process.h"            /* struct process */
+#include "sha256.h"             /* sha256() */
+#include "stats.h"              /* stage_begin() */
+#include "timeline.h"           /* timeline_block() */
 
 /* transmit threshold */
 #define TRANSM_THRESH 2
 
+/* number of entries in deduplication cache */
+#define DEDUP_SLOTS 32
+
+
+/*
+  BLOCK DEDUPLICATION
+
+  Some inputs, like backup streams or disk images, contain many byte-identical
+  regions.  Identical input blocks produce identical compressed blocks, so with
+  --dedup lbzip2 keeps a small cache of recently compressed blocks, indexed by
+  the SHA-256 digest of block contents taken after initial RLE.  If a newly
+  collected block is found in the cache then encoding and transmitting it is
+  skipped and the cached compressed block is copied instead.
+
+  Compressed blocks produced by lbzip2 are always padded to a whole number of
+  bytes (see encode()), so cached blocks can be output at any position in the
+  stream without any bit shifting.
+
+  Cache entries don't keep copies of the blocks themselves, which would cost
+  a block-sized allocation and copy on every miss.  Blocks are matched on
+  their size and digest instead.  The digest has to be cryptographic: with a
+  weaker checksum, input could be crafted so that two different blocks match,
+  and the cached block, which carries a valid block CRC, would silently
+  replace the other one in the output.
+*/
+struct dedup_ent {
+  uint8_t digest[SHA256_SIZE];
+  uint32_t crc;
+  size_t block_size;
+  void *buffer;                 /* transmitted block */
+  size_t size;
+  unsigned ref_count;           /* number of references, including cache */
+};
+
 
 struct in_blk {
   struct position pos;
@@ -50,6 +89,11 @@ struct work_blk {
   size_t size;
   uint32_t crc;
   size_t weight;
+
+  struct dedup_ent *dup;        /* cache entry holding the same block */
+  bool cache;                   /* insert into cache after transmission */
+  size_t block_size;
+  uint8_t digest[SHA256_SIZE];
 };
 
 
@@ -59,8 +103,115 @@ static struct pqueue(struct work_blk *) reord_q;
 static struct position order;
 static uintmax_t next_id;       /* next free input block sequence number */
 static uint32_t combined_crc;
+static unsigned stream_blocks;  /* number of blocks in current stream */
 static bool collect_token = true;
 static struct work_blk *unfinished_work;
+static struct dedup_ent *dedup_cache[DEDUP_SLOTS];
+
+
+/* Return the cache slot of block with given digest. */
+static struct dedup_ent **
+dedup_slot(const uint8_t *digest)
+{
+  uint32_t h;
+
+  memcpy(&h, digest, sizeof(h));
+  return &dedup_cache[h % DEDUP_SLOTS];
+}
+
+
+/* Drop reference to cache entry.  Must be called with scheduler locked. */
+static void
+dedup_release(struct dedup_ent *ent)
+{
+  if (--ent->ref_count == 0) {
+    free(ent->buffer);
+    free(ent);
+  }
+}
+
+
+/* Look up collected block in deduplication cache.  If the block is found,
+   record a reference to the matching cache entry in work block.  Otherwise
+   mark the block for insertion into cache after it is transmitted.  Called
+   with scheduler unlocked. */
+static void
+dedup_lookup(struct work_blk *wblk)
+{
+  const uint8_t *block;
+  struct dedup_ent *ent;
+
+  block = encoder_block(wblk->enc, &wblk->block_size);
+  sha256(block, wblk->block_size, wblk->digest);
+
+  sched_lock();
+  ent = *dedup_slot(wblk->digest);
+  if (ent != NULL && ent->block_size == wblk->block_size &&
+      memcmp(ent->digest, wblk->digest, SHA256_SIZE) == 0) {
+    ent->ref_count++;
+    wblk->dup = ent;
+  }
+  sched_unlock();
+
+  if (wblk->dup != NULL)
+    Trace(("block at {%ju,%ju} found in deduplication cache",
+           (uintmax_t)wblk->pos.major, (uintmax_t)wblk->pos.minor));
+  else
+    wblk->cache = true;
+}
+
+
+/* Insert transmitted block into deduplication cache, replacing any previous
+   entry in the same slot.  Called with scheduler unlocked. */
+static void
+dedup_insert(struct work_blk *wblk)
+{
+  struct dedup_ent *ent, **slot;
+
+  ent = XMALLOC(struct dedup_ent);
+  memcpy(ent->digest, wblk->digest, SHA256_SIZE);
+  ent->crc = wblk->crc;
+  ent->block_size = wblk->block_size;
+  ent->buffer = xmalloc(wblk->size);
+  ent->size = wblk->size;
+  ent->ref_count = 1;
+  memcpy(ent->buffer, wblk->buffer, wblk->size);
+
+  sched_lock();
+  slot = dedup_slot(ent->digest);
+  if (*slot != NULL)
+    dedup_release(*slot);
+  *slot = ent;
+  sched_unlock();
+}
+
+
+/* Encode collected block, unless it is already present in deduplication
+   cache.  Called with scheduler unlocked. */
+static void
+encode_block(struct work_blk *wblk)
+{
+  uint64_t t0;
+
+  wblk->dup = NULL;
+  wblk->cache = false;
+
+  if (dedup) {
+    dedup_lookup(wblk);
+
+    if (wblk->dup != NULL) {
+      free(wblk->enc);
+      wblk->enc = NULL;
+      wblk->size = wblk->dup->size;
+      wblk->crc = wblk->dup->crc;
+      return;
+    }
+  }
+
+  t0 = stage_begin();
+  wblk->size = encode(wblk->enc, &wblk->crc);
+  stage_end(STAGE_ENCODE, t0);
+}
 
 
 static bool
@@ -75,10 +226,12 @@ do_collect(void)
 {
   struct in_blk *iblk;
   struct work_blk *wblk;
+  uint64_t t0;
 
   iblk = dequeue(coll_q);
   --work_units;
   sched_unlock();
+  timeline_block(iblk->pos.major, iblk->pos.minor);
 
   wblk = XMALLOC(struct work_blk);
 
@@ -91,7 +244,9 @@ do_collect(void)
 
   /* Collect as much data as we can. */
   wblk->weight = iblk->left;
+  t0 = stage_begin();
   collect(wblk->enc, iblk->next, &iblk->left);
+  stage_end(STAGE_COLLECT, t0);
   wblk->weight -= iblk->left;
   iblk->next += wblk->weight;
 
@@ -110,10 +265,11 @@ do_collect(void)
   }
 
   /* Do the hard work. */
-  wblk->size = encode(wblk->enc, &wblk->crc);
+  encode_block(wblk);
 
   sched_lock();
   enqueue(trans_q, wblk);
+  stats_depth(QUEUE_TRANSMIT, size(trans_q));
 }
 
 
@@ -132,6 +288,7 @@ do_collect_seq(void)
   struct in_blk *iblk;
   struct work_blk *wblk;
   bool done = true;
+  uint64_t t0;
 
   wblk = unfinished_work;
   unfinished_work = NULL;
@@ -155,11 +312,14 @@ do_collect_seq(void)
     encoder_init(wblk->enc, bs100k * 100000u, CLUSTER_FACTOR);
     wblk->weight = 0;
   }
+  timeline_block(wblk->pos.major, wblk->pos.minor);
 
   /* Collect as much data as we can. */
   if (iblk != NULL) {
     wblk->size = iblk->left;
+    t0 = stage_begin();
     done = collect(wblk->enc, iblk->next, &iblk->left);
+    stage_end(STAGE_COLLECT, t0);
     wblk->size -= iblk->left;
     wblk->weight += wblk->size;
     iblk->next += wblk->size;
@@ -191,10 +351,11 @@ do_collect_seq(void)
   sched_unlock();
 
   /* Do the hard work. */
-  wblk->size = encode(wblk->enc, &wblk->crc);
+  encode_block(wblk);
 
   sched_lock();
   enqueue(trans_q, wblk);
+  stats_depth(QUEUE_TRANSMIT, size(trans_q));
 }
 
 
@@ -211,27 +372,80 @@ static void
 do_transmit(void)
 {
   struct work_blk *wblk;
+  uint64_t t0;
 
   wblk = dequeue(trans_q);
   --out_slots;
   sched_unlock();
+  timeline_block(wblk->pos.major, wblk->pos.minor);
+
+  t0 = stage_begin();
 
   /* Allocate the output buffer and transmit the block into it. */
-  wblk->buffer = XNMALLOC((wblk->size + 3) / 4, uint32_t);
+  wblk->buffer = XNMALLOC((wblk->size + TRANSMIT_SLACK + 3) / 4, uint32_t);
 
-  transmit(wblk->enc, wblk->buffer);
-  free(wblk->enc);
+  if (wblk->dup != NULL) {
+    memcpy(wblk->buffer, wblk->dup->buffer, wblk->size);
+  }
+  else {
+    transmit(wblk->enc, wblk->buffer);
+    free(wblk->enc);
+
+    if (wblk->cache)
+      dedup_insert(wblk);
+  }
+  stage_end(STAGE_TRANSMIT, t0);
 
   sched_lock();
+  if (wblk->dup != NULL)
+    dedup_release(wblk->dup);
   ++work_units;
   enqueue(reord_q, wblk);
+  stats_depth(QUEUE_REORDER, size(reord_q));
 }
 
 
+static void
+make_header(uint8_t *buffer)
+{
+  buffer[0] = 0x42;
+  buffer[1] = 0x5A;
+  buffer[2] = 0x68;
+  buffer[3] = 0x30 + bs100k;
+}
+
+
+static void
+make_trailer(uint8_t *buffer)
+{
+  buffer[0] = 0x17;
+  buffer[1] = 0x72;
+  buffer[2] = 0x45;
+  buffer[3] = 0x38;
+  buffer[4] = 0x50;
+  buffer[5] = 0x90;
+  buffer[6] = combined_crc >> 24;
+  buffer[7] = (combined_crc >> 16) & 0xFF;
+  buffer[8] = (combined_crc >> 8) & 0xFF;
+  buffer[9] = combined_crc & 0xFF;
+}
+
+
+/* With --stream-blocks, check whether current stream is complete and
+   a new one must be started before the next block is written. */
+static bool
+stream_full(void)
+{
+  return blocks_per_stream != 0 && stream_blocks == blocks_per_stream;
+}
+
+
+/* Ending a stream requires an output slot for the trailer and header. */
 static bool
 can_reorder(void)
 {
-  return !empty(reord_q) && pos_eq(peek(reord_q)->pos, order);
+  return !empty(reord_q) && pos_eq(peek(reord_q)->pos, order) &&
+      (!stream_full() || out_slots > 0);
 }
 
 
@@ -242,6 +456,22 @@ do_reorder(void)
 
   wblk = dequeue(reord_q);
   order = wblk->next;
+  timeline_block(wblk->pos.major, wblk->pos.minor);
+
+  /* Terminate current stream and begin a new one.  Blocks are always padded
+     to whole bytes, so the streams can be simply concatenated. */
+  if (stream_full()) {
+    uint8_t *buffer = XNMALLOC(TRAILER_SIZE + HEADER_SIZE, uint8_t);
+
+    make_trailer(buffer);
+    make_header(buffer + TRAILER_SIZE);
+    --out_slots;
+    sink_write_buffer(buffer, TRAILER_SIZE + HEADER_SIZE, 0);
+
+    combined_crc = 0;
+    stream_blocks = 0;
+  }
+  ++stream_blocks;
 
   sink_write_buffer(wblk->buffer, wblk->size, wblk->weight);
   combined_crc = combine_crc(combined_crc, wblk->crc);
@@ -272,6 +502,7 @@ on_input_avail(void *buffer, size_t size)
 
   sched_lock();
   enqueue(coll_q, iblk);
+  stats_depth(QUEUE_COLLECT, size(coll_q));
   sched_unlock();
 }
 
@@ -292,11 +523,7 @@ write_header(void)
 {
   uint8_t buffer[HEADER_SIZE];
 
-  buffer[0] = 0x42;
-  buffer[1] = 0x5A;
-  buffer[2] = 0x68;
-  buffer[3] = 0x30 + bs100k;
-
+  make_header(buffer);
   xwrite(buffer, HEADER_SIZE);
 }
 
@@ -306,17 +533,7 @@ write_trailer(void)
 {
   uint8_t buffer[TRAILER_SIZE];
 
-  buffer[0] = 0x17;
-  buffer[1] = 0x72;
-  buffer[2] = 0x45;
-  buffer[3] = 0x38;
-  buffer[4] = 0x50;
-  buffer[5] = 0x90;
-  buffer[6] = combined_crc >> 24;
-  buffer[7] = (combined_crc >> 16) & 0xFF;
-  buffer[8] = (combined_crc >> 8) & 0xFF;
-  buffer[9] = combined_crc & 0xFF;
-
+  make_trailer(buffer);
   xwrite(buffer, TRAILER_SIZE);
 }
 
@@ -334,6 +551,7 @@ init(void)
 
   assert(1 <= bs100k && bs100k <= 9);
   combined_crc = 0;
+  stream_blocks = 0;
 
   write_header();
 }
@@ -342,11 +560,20 @@ init(void)
 static void
 uninit(void)
 {
+  unsigned i;
+
   write_trailer();
 
   pqueue_uninit(coll_q);
   pqueue_uninit(trans_q);
   pqueue_uninit(reord_q);
+
+  for (i = 0; i < DEDUP_SLOTS; i++) {
+    if (dedup_cache[i] != NULL) {
+      dedup_release(dedup_cache[i]);
+      dedup_cache[i] = NULL;
+    }
+  }
 }
 
 
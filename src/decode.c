@@ -22,6 +22,7 @@
 #include "common.h"
 #include <arpa/inet.h>          /* ntohl() */
 #include <string.h>             /* memcpy() */
+#include <sys/mman.h>           /* madvise() */
 
 #include "decode.h"
 #include "main.h"
@@ -1144,13 +1145,44 @@ emit(struct decoder_state *ds, void *buf, size_t *buf_sz)
 }
 
 
+/* Allocate the "tt" array.  It is large and accessed randomly by decode()
+   and emit(), so where transparent huge pages are supported it is aligned
+   to huge page boundary and backed by huge pages, which saves TLB misses
+   and page faults. */
+static uint32_t *
+alloc_tt(void)
+{
+#ifdef MADV_HUGEPAGE
+  void *tt;
+
+  if (posix_memalign(&tt, 2u << 20, MAX_BLOCK_SIZE * sizeof(uint32_t)) == 0) {
+    (void)madvise(tt, MAX_BLOCK_SIZE * sizeof(uint32_t), MADV_HUGEPAGE);
+    return tt;
+  }
+#endif
+
+  return XNMALLOC(MAX_BLOCK_SIZE, uint32_t);
+}
+
+
 void
 decoder_init(struct decoder_state *ds)
 {
-  ds->internal_state = XMALLOC(struct retriever_internal_state);
-  ds->internal_state->state = S_INIT;
+  ds->internal_state = NULL;
+  ds->tt = alloc_tt();
+  decoder_reset(ds);
+}
+
 
-  ds->tt = XNMALLOC(MAX_BLOCK_SIZE, uint32_t);
+/* Prepare decoder state for retrieving another block, reusing its "tt"
+   array.  Internal state of the retriever is released as soon as a block is
+   retrieved, so it may need to be allocated again. */
+void
+decoder_reset(struct decoder_state *ds)
+{
+  if (ds->internal_state == NULL)
+    ds->internal_state = XMALLOC(struct retriever_internal_state);
+  ds->internal_state->state = S_INIT;
   ds->block_size = 0;
 }
 
@@ -1161,3 +1193,33 @@ decoder_free(struct decoder_state *ds)
   free(ds->tt);
   free(ds->internal_state);
 }
+
+
+/* Return a human-readable description of error code ERR. */
+const char *
+err2str(int err)
+{
+  static const char *table[] = {
+    "bad stream header magic",
+    "bad block header magic",
+    "empty source alphabet",
+    "bad number of trees",
+    "no coding groups",
+    "invalid selector",
+    "invalid delta code",
+    "invalid prefix code",
+    "incomplete prefix code",
+    "empty block",
+    "unterminated block",
+    "missing run length",
+    "block CRC mismatch",
+    "stream CRC mismatch",
+    "block overflow",
+    "primary index too large",
+    "unexpected end of file",
+  };
+
+  assert(err >= ERR_MAGIC && err <= ERR_EOF);
+
+  return table[err - ERR_MAGIC];
+}
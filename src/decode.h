@@ -75,7 +75,10 @@ int parse(struct parser_state *ps, struct header *hd, struct bitstream *bs,
 int scan(struct bitstream *bs, unsigned skip);
 
 void decoder_init(struct decoder_state *ds);
+void decoder_reset(struct decoder_state *ds);
 void decoder_free(struct decoder_state *ds);
 int retrieve(struct decoder_state *ds, struct bitstream *bs);
 void decode(struct decoder_state *ds);
 int emit(struct decoder_state *ds, void *buf, size_t *buf_sz);
+
+const char *err2str(int err);
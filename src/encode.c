@@ -23,7 +23,7 @@
 #include "encode.h"
 
 #include <arpa/inet.h>          /* htonl() */
-#include <string.h>             /* memset() */
+#include <string.h>             /* memset(), memcpy() */
 
 
 /*
@@ -98,10 +98,31 @@ struct encoder_state {
 };
 
 extern uint32_t crc_table[256];
+extern uint32_t crc_slice_table[8][256];
 
 
 #define CRC(x) crc = (crc << 8) ^ crc_table[(crc >> 24) ^ (x)]
 
+/* Fold 8 consecutive bytes into CRC at once (slicing-by-8). */
+#define CRC8(b)                                                 \
+  do {                                                          \
+    uint32_t c = crc ^ ((uint32_t)(b)[0] << 24 |                \
+                        (uint32_t)(b)[1] << 16 |                \
+                        (uint32_t)(b)[2] << 8 | (b)[3]);        \
+    crc = (crc_slice_table[7][c >> 24] ^                        \
+           crc_slice_table[6][(c >> 16) & 0xFF] ^               \
+           crc_slice_table[5][(c >> 8) & 0xFF] ^                \
+           crc_slice_table[4][c & 0xFF] ^                       \
+           crc_slice_table[3][(b)[4]] ^                         \
+           crc_slice_table[2][(b)[5]] ^                         \
+           crc_slice_table[1][(b)[6]] ^                         \
+           crc_slice_table[0][(b)[7]]);                         \
+  } while (0)
+
+/* Nonzero iff any byte of 64-bit word x is zero. */
+#define HAS_ZERO_BYTE(x)                                        \
+  (((x) - 0x0101010101010101ULL) & ~(x) & 0x8080808080808080ULL)
+
 #define MAX_RUN_LENGTH (4+255)
 
 
@@ -190,6 +211,35 @@ state0:
 
 state1:
   /*=== STATE 1 ===*/
+  /* Fast path for data without runs.  Current character ch was fetched
+     from p[-1], so XOR-ing 8 bytes at p with 8 bytes at p-1 yields a zero
+     byte exactly where two adjacent characters are equal.  If there are
+     no such bytes, then the next 8 iterations of S1 would all stay in
+     state 1, so they can be done at once, word at a time. */
+  while (likely(pLim - p >= 8 && qMax - q >= 8)) {
+    uint64_t w, x;
+
+    memcpy(&w, p, 8);
+    memcpy(&x, p - 1, 8);
+    x ^= w;
+    if (HAS_ZERO_BYTE(x))
+      break;
+
+    q[0] = ch;
+    memcpy(q + 1, p, 7);
+    s->cmap[ch] = true;
+    s->cmap[p[0]] = true;
+    s->cmap[p[1]] = true;
+    s->cmap[p[2]] = true;
+    s->cmap[p[3]] = true;
+    s->cmap[p[4]] = true;
+    s->cmap[p[5]] = true;
+    s->cmap[p[6]] = true;
+    CRC8(p);
+    ch = p[7];
+    p += 8;
+    q += 8;
+  }
   S1;
   S1;
   S1;
@@ -336,6 +386,32 @@ done:
 }
 
 
+/* Finalize initial RLE by appending length of any unfinished run. */
+static void
+finish_rle(struct encoder_state *s)
+{
+  uint8_t *block = (void *)(s->SA + s->max_block_size + GROUP_SIZE);
+
+  if (s->rle_state >= 4) {
+    assert(s->nblock < s->max_block_size);
+    block[s->nblock++] = s->rle_state - 4;
+    s->cmap[s->rle_state - 4] = true;
+    s->rle_state = 0;
+  }
+}
+
+
+/* Return the block collected so far, after initial RLE, and store its length
+   in `*size'.  No more data can be collected after calling this function. */
+const uint8_t *
+encoder_block(struct encoder_state *s, size_t *size)
+{
+  finish_rle(s);
+  *size = s->nblock;
+  return (void *)(s->SA + s->max_block_size + GROUP_SIZE);
+}
+
+
 /* return ninuse */
 static unsigned
 make_map_e(uint8_t *cmap, const bool *inuse)
@@ -355,13 +431,35 @@ make_map_e(uint8_t *cmap, const bool *inuse)
 }
 
 
+/* Vectorized MTF is implemented using GCC vector extensions, which are
+   compiled to SIMD instructions on most architectures, like SSE2 or NEON.
+
+   Instead of an ordered list of symbols, rank of every symbol (its current
+   position in MTF list) is kept.  Moving symbol c of rank r to front means
+   setting rank of c to 0 and incrementing ranks of all symbols with rank
+   lower than r.  This is done for all symbols at once with a few vector
+   operations, without any data-dependent branches.  Only EOB-1 symbols are
+   in use, so for typical text only about 6 vectors need to be updated.
+*/
+#if GNUC_VERSION >= 40900
+# define VECTOR_MTF
+typedef uint8_t mtf_vec __attribute__((vector_size(16)));
+#endif
+
 /*---------------------------------------------------*/
 /* returns nmtf */
 static uint32_t
 do_mtf(int32_t *bwt, uint32_t *mtffreq, uint8_t *cmap, int32_t nblock,
        int32_t EOB)
 {
+#ifdef VECTOR_MTF
+  mtf_vec rank[16];
+  uint8_t *rank8 = (uint8_t *)rank;
+  int32_t nvec;
+  int32_t j;
+#else
   uint8_t order[255];
+#endif
   int32_t i;
   int32_t k;
   int32_t t;
@@ -375,8 +473,14 @@ do_mtf(int32_t *bwt, uint32_t *mtffreq, uint8_t *cmap, int32_t nblock,
 
   k = 0;
   u = 0;
+#ifdef VECTOR_MTF
+  for (i = 0; i < 256; i++)
+    rank8[i] = i;
+  nvec = (EOB - 1 + 15) / 16;
+#else
   for (i = 0; i < 255; i++)
     order[i] = i + 1;
+#endif
 
 #define RUN()                                   \
   if (unlikely(k))                              \
@@ -385,6 +489,19 @@ do_mtf(int32_t *bwt, uint32_t *mtffreq, uint8_t *cmap, int32_t nblock,
       k >>= 1;                                  \
     } while (k)                                 \
 
+#ifdef VECTOR_MTF
+#define MTF()                                   \
+  {                                             \
+    mtf_vec r = (mtf_vec){ 0 } + rank8[c];      \
+    t = rank8[c] + 1;                           \
+    for (j = 0; j < nvec; j++)                  \
+      rank[j] -= (mtf_vec)(rank[j] < r);        \
+    rank8[c] = 0;                               \
+    u = c;                                      \
+    *mtfv++ = t;                                \
+    mtffreq[t]++;                               \
+  }
+#else
 #define MTF()                                   \
   {                                             \
     uint8_t *p = order;                         \
@@ -403,6 +520,7 @@ do_mtf(int32_t *bwt, uint32_t *mtffreq, uint8_t *cmap, int32_t nblock,
     *mtfv++ = t;                                \
     mtffreq[t]++;                               \
   }
+#endif
 
   for (i = 0; i < nblock; i++) {
     if ((c = cmap[*bwt++]) == u) {
@@ -424,27 +542,17 @@ do_mtf(int32_t *bwt, uint32_t *mtffreq, uint8_t *cmap, int32_t nblock,
 #undef MTF
 }
 
-size_t
-encode(struct encoder_state *s, uint32_t *crc)
+/* Sort the block and compute its MTF values, leaving the encoder ready for
+   generate_prefix_code().  This is the first half of encode(), callable on
+   its own so that kbench can time prefix code generation in isolation. */
+void
+encode_mtf(struct encoder_state *s)
 {
-  uint32_t cost;
-  uint32_t pk;
-  uint32_t i;
-  const uint8_t *sp;            /* selector pointer */
-  uint8_t *smp;                 /* selector MTFV pointer */
-  uint8_t c;                    /* value before MTF */
-  uint8_t j;                    /* value after MTF */
-  uint32_t p;                   /* MTF state */
   uint32_t EOB;
   uint8_t cmap[256];
   uint8_t *block = (void *)(s->SA + s->max_block_size + GROUP_SIZE);
 
-  /* Finalize initial RLE. */
-  if (s->rle_state >= 4) {
-    assert(s->nblock < s->max_block_size);
-    block[s->nblock++] = s->rle_state - 4;
-    s->cmap[s->rle_state - 4] = true;
-  }
+  finish_rle(s);
   assert(s->nblock > 0);
 
   EOB = make_map_e(cmap, s->cmap) + 1;
@@ -456,6 +564,21 @@ encode(struct encoder_state *s, uint32_t *crc)
 
   s->bwt_idx = divbwt(block, s->SA, s->u.bucket, s->nblock);
   s->nmtf = do_mtf(s->SA, s->u.s.code[0], cmap, s->nblock, EOB);
+}
+
+size_t
+encode(struct encoder_state *s, uint32_t *crc)
+{
+  uint32_t cost;
+  uint32_t pk;
+  uint32_t i;
+  const uint8_t *sp;            /* selector pointer */
+  uint8_t *smp;                 /* selector MTFV pointer */
+  uint8_t c;                    /* value before MTF */
+  uint8_t j;                    /* value after MTF */
+  uint32_t p;                   /* MTF state */
+
+  encode_mtf(s);
 
   cost = 48    /* header */
        + 32    /* crc */
@@ -964,9 +1087,11 @@ assign_codes(uint32_t *code, uint8_t *length,
   assert(next_code == (1UL << (best_height + 1)));
   assert(leaf == as);
 
-  /* Assign prefix-free codes. */
+  /* Assign prefix-free codes.  Each code is stored together with its
+     length, as (code << 5) | length, so that transmit() needs to do only
+     one table lookup per symbol. */
   for (symbol = 0; symbol < as; symbol++)
-    code[symbol] = base_code[length[symbol]]++;
+    code[symbol] = (base_code[length[symbol]]++ << 5) | length[symbol];
 
 #ifdef ENABLE_TRACING
   Trace(("  Prefix code dump:"));
@@ -976,7 +1101,7 @@ assign_codes(uint32_t *code, uint8_t *length,
     unsigned len = length[symbol];
 
     while (len-- > 0)
-      *p++ = (code[symbol] & (1UL << len)) ? '1' : '0';
+      *p++ = ((code[symbol] >> 5) & (1UL << len)) ? '1' : '0';
     *p = 0;
 
     Trace(("    symbol %3u has code %s", symbol, buffer));
@@ -1148,6 +1273,23 @@ generate_prefix_code(struct encoder_state *s)
   if (k >= 32) {                                \
     DUMP();                                     \
   }
+/* Append combined code word cw, as computed by assign_codes(). */
+#define SEND_CODE(cw)                           \
+  b = (b << ((cw) & 31)) | ((cw) >> 5);         \
+  k += (cw) & 31;
+/* Store all complete bytes of bit buffer with a single unaligned 64-bit
+   store, leaving less than 8 bits in the buffer.  Up to 8 bytes can be
+   written past the last complete byte. */
+#define FLUSH()                                 \
+  {                                             \
+    uint64_t w = b << (63 - k) << 1;            \
+    uint32_t hi = htonl((uint32_t)(w >> 32));   \
+    uint32_t lo = htonl((uint32_t)w);           \
+    memcpy(q, &hi, 4);                          \
+    memcpy(q + 4, &lo, 4);                      \
+    q += k >> 3;                                \
+    k &= 7;                                     \
+  }
 
 void *
 transmit(struct encoder_state *s, void *buf)
@@ -1159,6 +1301,7 @@ transmit(struct encoder_state *s, void *buf)
   unsigned v;
   uint16_t *mtfv;
   uint32_t *p;
+  uint8_t *q;
   unsigned ns;
   unsigned as;
   uint32_t gr;
@@ -1176,7 +1319,7 @@ transmit(struct encoder_state *s, void *buf)
   /* If no external buffer was provided then use an internal buffer. */
   if (!buf) {
     buf = &mtfv[ns * GROUP_SIZE];
-    assert((char *)buf + (s->out_expect_len + 3) / 4 * 4 <=
+    assert((char *)buf + s->out_expect_len + TRANSMIT_SLACK <=
            (char *)s + encoder_alloc_size(s->max_block_size));
     p = buf;
   }
@@ -1254,28 +1397,30 @@ transmit(struct encoder_state *s, void *buf)
     }
   }
 
-  /* Transmit prefix codes. */
+  /* Transmit prefix codes.  Codes are at most MAX_CODE_LENGTH (20) bits
+     long, so after a flush there is always room in the 64-bit bit buffer
+     for two codes.  The bit buffer is flushed after every second code
+     unconditionally, which avoids data-dependent branches. */
+  q = (uint8_t *)p;
+  FLUSH();
   for (gr = 0; gr < ns; gr++) {
     unsigned i;          /* symbol index in group */
-    const uint32_t *L;   /* symbol-to-code lookup table */
-    const uint8_t *B;    /* code lengths */
-    unsigned mv;         /* symbol (MTF value) */
+    const uint32_t *C;   /* symbol-to-code lookup table */
 
-    t = s->u.s.selector[gr];
-    L = s->u.s.code[t];
-    B = s->u.s.length[t];
+    C = s->u.s.code[s->u.s.selector[gr]];
 
-    for (i = 0; i < GROUP_SIZE; i++) {
-      mv = *mtfv++;
-      SEND(B[mv], L[mv]);
+    for (i = 0; i < GROUP_SIZE; i += 2) {
+      SEND_CODE(C[mtfv[0]]);
+      SEND_CODE(C[mtfv[1]]);
+      mtfv += 2;
+      FLUSH();
     }
   }
 
-  /* Flush  */
-  assert(k % 8 == 0);
-  assert(k / 8 == s->out_expect_len % 4);
-  assert(p == (uint32_t *)buf + s->out_expect_len / 4);
-  SEND(31, 0);
+  /* Blocks are always padded to whole bytes, so there can't be any bits
+     left in the bit buffer. */
+  assert(k == 0);
+  assert(q == (uint8_t *)buf + s->out_expect_len);
 
   return buf;
 }
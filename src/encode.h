@@ -23,13 +23,18 @@
 #define HEADER_SIZE     4u
 #define TRAILER_SIZE    10u
 
+/* Number of bytes transmit() may write past the end of transmitted block. */
+#define TRANSMIT_SLACK  8u
+
 
 struct encoder_state;
 
 size_t encoder_alloc_size(unsigned long mbs);
 void encoder_init(struct encoder_state *e, unsigned long mbs, unsigned cf);
 int collect(struct encoder_state *e, const uint8_t *buf, size_t *buf_sz);
+const uint8_t *encoder_block(struct encoder_state *e, size_t *size);
 size_t encode(struct encoder_state *e, uint32_t *crc);
+void encode_mtf(struct encoder_state *e);
 void *transmit(struct encoder_state *e, void *buf);
 unsigned generate_prefix_code(struct encoder_state *s);
 
@@ -24,6 +24,8 @@
 #include "decode.h"             /* decode() */
 #include "main.h"               /* bs100k */
 #include "process.h"            /* struct process */
+#include "stats.h"              /* stage_begin() */
+#include "timeline.h"           /* timeline_block() */
 
 #include <string.h>             /* memset() */
 
@@ -60,40 +62,16 @@
 #define nbsp2(p) (empty(p) ? 0u : nbs2(peek(p)))
 #endif
 
+/* Upper bound on size of output of a block of "n" bytes, as retrieved, after
+   undoing the initial run-length encoding.  At most every fifth byte can be
+   a run length, which stands for up to 255 copies of the preceding byte. */
+#define UNRLE_BOUND(n) ((size_t)(n) + 254u * ((size_t)(n) / 5u))
+
 #define SCAN_THRESH 1u
 #define EMIT_THRESH 2u
 #define UNORD_THRESH (SCAN_THRESH + EMIT_THRESH)
 
 
-static const char *
-err2str(int err)
-{
-  static const char *table[] = {
-    "bad stream header magic",
-    "bad block header magic",
-    "empty source alphabet",
-    "bad number of trees",
-    "no coding groups",
-    "invalid selector",
-    "invalid delta code",
-    "invalid prefix code",
-    "incomplete prefix code",
-    "empty block",
-    "unterminated block",
-    "missing run length",
-    "block CRC mismatch",
-    "stream CRC mismatch",
-    "block overflow",
-    "primary index too large",
-    "unexpected end of file",
-  };
-
-  assert(err >= ERR_MAGIC && err <= ERR_EOF);
-
-  return table[err - ERR_MAGIC];
-}
-
-
 struct in_blk {
   void *buffer;
   size_t size;
@@ -128,6 +106,8 @@ struct emit_blk {
   struct decoder_state ds;
   int status;
   uintmax_t end_offset;
+  bool started;         /* true iff some output was already emitted */
+  size_t out_bound;     /* upper bound on size of output still to emit */
 };
 
 struct head_blk {
@@ -152,6 +132,7 @@ static uintmax_t head_offs;
 static uintmax_t tail_offs;
 
 static struct pqueue(struct retr_blk *) retr_q;
+static struct pqueue(struct emit_blk *) decode_q;
 static struct pqueue(struct emit_blk *) emit_q;
 static struct pqueue(struct out_blk *) reord_q;
 static struct deque(struct head_blk) order_q;
@@ -164,6 +145,13 @@ static uintmax_t reord_offs;
 static struct detached_bitstream parser_bs;
 static struct parser_state par;
 
+/* Decoder states are expensive to set up, mostly because of their large
+   "tt" arrays, so released ones are kept in "ds_pool" for reuse by the next
+   blocks.  Every decoder state in use holds a work unit, so the pool never
+   needs to hold more than "num_worker" of them. */
+static struct decoder_state *ds_pool;
+static unsigned ds_pool_size;
+
 
 #if 1
 #define check_invariants()
@@ -206,6 +194,7 @@ dump_info(void)
          "\n\t" "size(input_q): %2u"
          "\n\t" "size(scan_q):  %2u {%6u}"
          "\n\t" "size(retr_q):  %2u {%6u}"
+         "\n\t" "size(dec_q):   %2u {%6u}"
          "\n\t" "size(emit_q):  %2u {%6u}"
          "\n\t" "size(reord_q): %2u {%6u}"
          "\n\t" "size(order_q): %2u {%6u}"
@@ -217,7 +206,8 @@ dump_info(void)
          (unsigned)head_offs * 32u, (unsigned)tail_offs * 32u,
          size(input_q), size(scan_q),
          nbsp2(scan_q), size(retr_q),
-         nbsp2(retr_q), size(emit_q),
+         nbsp2(retr_q), size(decode_q),
+         nbsp2(decode_q), size(emit_q),
          nbsp2(emit_q), size(reord_q),
          nbsp2(reord_q), size(order_q),
          nbsd2(order_q), size(unord_q),
@@ -226,6 +216,31 @@ dump_info(void)
 #endif
 
 
+/* Get a decoder state ready to retrieve a block, reusing a pooled one if
+   possible.  Called with scheduler lock held. */
+static void
+get_decoder(struct decoder_state *ds)
+{
+  if (ds_pool_size > 0u) {
+    *ds = ds_pool[--ds_pool_size];
+    decoder_reset(ds);
+  }
+  else {
+    decoder_init(ds);
+  }
+}
+
+/* Release a decoder state to the pool.  Called with scheduler lock held. */
+static void
+put_decoder(struct decoder_state *ds)
+{
+  if (ds_pool_size < num_worker)
+    ds_pool[ds_pool_size++] = *ds;
+  else
+    decoder_free(ds);
+}
+
+
 static struct detached_bitstream
 bits_init(uintmax_t offset)
 {
@@ -371,7 +386,7 @@ advance(struct detached_bitstream bs)
     Trace(("Advanced over miss-recognized bit pattern at {%u}",
            nbsx2(rb->base)));
 
-    decoder_free(&rb->ds);
+    put_decoder(&rb->ds);
     free(rb);
     work_units++;
   }
@@ -397,14 +412,18 @@ do_parse(void)
   struct head_blk head_blk;
   struct bitstream true_bitstream;
   unsigned garbage;
+  uint64_t t0;
 
   Trace(("Parser running at {%lu}",
          32ul + 32ul * parser_bs.offset - parser_bs.live));
 
   parse_token = 0;
   --work_units;
+  timeline_block(parser_bs.pos.major, parser_bs.pos.minor);
   true_bitstream = attach(parser_bs);
+  t0 = stage_begin();
   rv = parse(&par, &head_blk.hdr, &true_bitstream, &garbage);
+  stage_end(STAGE_PARSE, t0);
   advance(detach(true_bitstream));
   check_invariants();
 
@@ -456,7 +475,7 @@ do_parse(void)
       Trace(("Parser discovered a bit pattern beyond EOF at {%u}",
              nbsx2(rb->base)));
 
-      decoder_free(&rb->ds);
+      put_decoder(&rb->ds);
       free(rb);
       work_units++;
     }
@@ -532,10 +551,11 @@ do_parse(void)
     struct retr_blk *rb = XMALLOC(struct retr_blk);
 
     rb->unord_link = NULL;
-    decoder_init(&rb->ds);
+    get_decoder(&rb->ds);
     rb->curr_pos = parser_bs;
     rb->base = parser_bs.pos;
     enqueue(retr_q, rb);
+    stats_depth(QUEUE_RETRIEVE, size(retr_q));
     Trace(("Parser found a unique block at {%u}", nbsx2(rb->base)));
   }
 
@@ -549,6 +569,17 @@ can_retrieve(void)
   return !empty(retr_q) && can_attach(peek(retr_q)->curr_pos);
 }
 
+/* Retrieving the block that is to be written next is on the critical path:
+   until it is emitted, output of all following blocks waits in reord_q,
+   holding output slots.  Such a retrieve job is therefore run before any
+   emit job of a block further ahead. */
+static bool
+can_retrieve_head(void)
+{
+  return (can_retrieve() && !empty(order_q)
+          && pos_eq(peek(retr_q)->base, dq_get(order_q, 0).base));
+}
+
 static void
 do_retrieve(void)
 {
@@ -556,16 +587,20 @@ do_retrieve(void)
   struct emit_blk *eb;
   struct bitstream true_bitstream;
   int rv;
+  uint64_t t0;
 
   assert(!parsing_done);
   rb = dequeue(retr_q);
+  timeline_block(rb->base.major, rb->base.minor);
 
   true_bitstream = attach(rb->curr_pos);
+  t0 = stage_begin();
   rv = retrieve(&rb->ds, &true_bitstream);
+  stage_end(STAGE_RETRIEVE, t0);
   rb->curr_pos = detach(true_bitstream);
 
   if (parsing_done) {
-    decoder_free(&rb->ds);
+    put_decoder(&rb->ds);
     free(rb);
     work_units++;
     check_invariants();
@@ -579,7 +614,7 @@ do_retrieve(void)
        abort this retrieve job. */
     Trace(("Retriever found himself redundand"));
     work_units++;
-    decoder_free(&rb->ds);
+    put_decoder(&rb->ds);
     free(rb);
     check_invariants();
     return;
@@ -619,34 +654,86 @@ do_retrieve(void)
     /* Parser knows about us, unord block is no longer needed. */
     free(rb->unord_link);
   }
-  check_invariants();
-  sched_unlock();
-
-  if (rv == OK)
-    decode(&rb->ds);
 
   eb = XMALLOC(struct emit_blk);
 
   eb->ds = rb->ds;
   eb->base = rb->base;
   eb->end_offset = rb->curr_pos.offset;
+  eb->started = false;
+  eb->out_bound = rv == OK ? max(1u, UNRLE_BOUND(eb->ds.block_size)) : 1u;
   free(rb);
 
   eb->status = rv;
 
+  /* Blocks that failed to be retrieved go straight to emit, which passes
+     the error on. */
+  if (rv == OK) {
+    enqueue(decode_q, eb);
+    stats_depth(QUEUE_DECODE, size(decode_q));
+  }
+  else {
+    enqueue(emit_q, eb);
+    stats_depth(QUEUE_EMIT, size(emit_q));
+  }
+  check_invariants();
+}
+
+
+/* Decoding a block is a separate task rather than a part of retrieving, so
+   that it can be run by another worker as soon as one is free, and ranks
+   above emitting later blocks.  This lets decoding of one block overlap with
+   emitting of the previous one even when only a few blocks are in flight. */
+static bool
+can_decode(void)
+{
+  return !empty(decode_q);
+}
+
+static void
+do_decode(void)
+{
+  struct emit_blk *eb;
+  uint64_t t0;
+
+  eb = dequeue(decode_q);
+  check_invariants();
+  sched_unlock();
+  timeline_block(eb->base.major, eb->base.minor);
+
+  t0 = stage_begin();
+  decode(&eb->ds);
+  stage_end(STAGE_DECODE, t0);
+
   sched_lock();
   enqueue(emit_q, eb);
+  stats_depth(QUEUE_EMIT, size(emit_q));
   check_invariants();
 }
 
 
+/* Output of highly compressible blocks can be many times larger than an
+   output slot, so it is emitted in chunks.  The block at the head of order_q
+   can use any free output slot, and so can bogus blocks behind it, which are
+   discarded by do_reorder() right away.  Blocks that aren't written next may
+   emit only their first chunk ahead of time, provided that enough slots are
+   left for the head block; the rest waits until they get to the head.  This
+   bounds the amount of buffered output to about one chunk per block being
+   decompressed, no matter how much a block expands. */
 static bool
 can_emit(void)
 {
-  return (!empty(emit_q) &&
-          (out_slots > EMIT_THRESH
-           || (out_slots > 0 && !empty(order_q)
-               && pos_eq(peek(emit_q)->base, dq_get(order_q, 0).base))));
+  const struct emit_blk *eb;
+
+  if (empty(emit_q) || out_slots == 0)
+    return false;
+
+  eb = peek(emit_q);
+  if (!empty(order_q) ? pos_le(eb->base, dq_get(order_q, 0).base)
+      : parsing_done)
+    return true;
+
+  return out_slots > EMIT_THRESH && !eb->started;
 }
 
 static void
@@ -654,39 +741,51 @@ do_emit(void)
 {
   struct emit_blk *eb;
   struct out_blk *oblk;
+  size_t alloc;
   int rv;
+  uint64_t t0;
 
   out_slots--;
   eb = dequeue(emit_q);
   check_invariants();
   sched_unlock();
+  timeline_block(eb->base.major, eb->base.minor);
 
-  oblk = xmalloc(sizeof(struct out_blk) + out_granul);
-  oblk->size = out_granul;
+  /* Small blocks don't need the whole output slot. */
+  alloc = min(out_granul, eb->out_bound);
+  oblk = xmalloc(sizeof(struct out_blk) + alloc);
+  oblk->size = alloc;
   oblk->blk_sz = eb->ds.block_size;
   rv = eb->status;
-  if (rv == OK)
+  if (rv == OK) {
+    t0 = stage_begin();
     rv = emit(&eb->ds, oblk + 1, &oblk->size);
-  oblk->size = out_granul - oblk->size;
+    stage_end(STAGE_EMIT, t0);
+  }
+  oblk->size = alloc - oblk->size;
   oblk->status = rv;
   oblk->base = eb->base;
 
   if (rv == MORE) {
     oblk->end_offset = 0;
     eb->base.minor++;
+    eb->started = true;
+    assert(oblk->size <= eb->out_bound);
+    eb->out_bound = max(1u, eb->out_bound - oblk->size);
     sched_lock();
     enqueue(emit_q, eb);
   }
   else {
     oblk->end_offset = eb->end_offset;
     oblk->crc = eb->ds.crc;
-    decoder_free(&eb->ds);
-    free(eb);
     sched_lock();
+    put_decoder(&eb->ds);
+    free(eb);
     work_units++;
   }
 
   enqueue(reord_q, oblk);
+  stats_depth(QUEUE_REORDER, size(reord_q));
   check_invariants();
 }
 
@@ -717,6 +816,7 @@ do_reorder(void)
 
   ord = shift(order_q);
   oblk = dequeue(reord_q);
+  timeline_block(oblk->base.major, oblk->base.minor);
 
   offs_incr = (reord_offs < oblk->end_offset ?
                oblk->end_offset - reord_offs : 0u);
@@ -754,10 +854,12 @@ do_scan(void)
   int scan_result;
   unsigned skip;
   struct bitstream true_bitstream;
+  uint64_t t0;
 
   assert(!parsing_done);
   work_units--;
   bs = dequeue(scan_q);
+  timeline_block(bs->pos.major, bs->pos.minor);
 
   skip = 0u;
   assert(bs->pos.major >= parser_bs.pos.major);
@@ -767,7 +869,9 @@ do_scan(void)
   }
 
   true_bitstream = attach(*bs);
+  t0 = stage_begin();
   scan_result = scan(&true_bitstream, skip);
+  stage_end(STAGE_SCAN, t0);
   *bs = detach(true_bitstream);
 
   if (scan_result != OK || parsing_done) {
@@ -794,13 +898,15 @@ do_scan(void)
     ub->end_pos = *bs;
     ub->complete = false;
     enqueue(unord_q, ub);
+    stats_depth(QUEUE_UNORDERED, size(unord_q));
 
     rb = XMALLOC(struct retr_blk);
     rb->unord_link = ub;
-    decoder_init(&rb->ds);
+    get_decoder(&rb->ds);
     rb->curr_pos = *bs;
     rb->base = bs->pos;
     enqueue(retr_q, rb);
+    stats_depth(QUEUE_RETRIEVE, size(retr_q));
   }
 
   if (true_bitstream.data != true_bitstream.limit && bs->offset >= head_offs) {
@@ -857,6 +963,8 @@ on_input_avail(void *buffer, size_t size)
   tail_offs += iblk->size;
   push(input_q, iblk);
   enqueue(scan_q, scan_task);
+  stats_depth(QUEUE_INPUT, size(input_q));
+  stats_depth(QUEUE_SCAN, size(scan_q));
   check_invariants();
   sched_unlock();
 }
@@ -882,12 +990,16 @@ init(void)
   deque_init(input_q, in_slots);
   pqueue_init(scan_q, in_slots);
   pqueue_init(retr_q, work_units);
+  pqueue_init(decode_q, work_units);
   pqueue_init(emit_q, work_units);
   pqueue_init(unord_q, (work_units + out_slots > UNORD_THRESH ?
                         work_units + out_slots - UNORD_THRESH : 0));
   deque_init(order_q, work_units + out_slots);
   pqueue_init(reord_q, out_slots);
 
+  ds_pool = XNMALLOC(num_worker, struct decoder_state);
+  ds_pool_size = 0u;
+
   head_offs = 0;
   tail_offs = 0;
   eof_missing = 0;
@@ -912,18 +1024,25 @@ uninit(void)
   deque_uninit(order_q);
   pqueue_uninit(reord_q);
   pqueue_uninit(emit_q);
+  pqueue_uninit(decode_q);
   pqueue_uninit(retr_q);
   deque_uninit(input_q);
+
+  while (ds_pool_size > 0u)
+    decoder_free(&ds_pool[--ds_pool_size]);
+  free(ds_pool);
 }
 
 
 static const struct task task_list[] = {
-  { "reorder",  can_reorder,  do_reorder  },
-  { "parse",    can_parse,    do_parse    },
-  { "emit",     can_emit,     do_emit     },
-  { "retrieve", can_retrieve, do_retrieve },
-  { "scan",     can_scan,     do_scan     },
-  { NULL,       NULL,         NULL        },
+  { "reorder",  can_reorder,       do_reorder  },
+  { "parse",    can_parse,         do_parse    },
+  { "retrieve", can_retrieve_head, do_retrieve },
+  { "decode",   can_decode,        do_decode   },
+  { "emit",     can_emit,          do_emit     },
+  { "retrieve", can_retrieve,      do_retrieve },
+  { "scan",     can_scan,          do_scan     },
+  { NULL,       NULL,              NULL        },
 };
 
 const struct process expansion = {
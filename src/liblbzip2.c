@@ -0,0 +1,1189 @@
+/*-
+  liblbzip2.c -- embeddable parallel bzip2 compressor and decompressor
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+#include <pthread.h>            /* pthread_t */
+#include <string.h>             /* memcpy() */
+#include <unistd.h>             /* sysconf() */
+
+#include "encode.h"             /* encode() */
+#include "decode.h"             /* decode() */
+#include "main.h"               /* xmalloc() */
+
+#include "liblbzip2.h"          /* struct lbzip2_ctx */
+
+
+/*
+  The lbzip2 executable drives compression and expansion through the
+  process.c scheduler, which keeps all of its state (queues, slot counters,
+  the input and output file descriptors) in file-scope variables and
+  terminates the program on any error.  That is fine for a program that
+  processes one file at a time, but a library must support any number of
+  independent streams and must report errors to the caller, so here the same
+  low-level kernels are driven by a small per-context scheduler instead.
+
+  Compression: input is collected into blocks on the caller's thread, full
+  blocks are encoded and transmitted by worker threads, and the caller pulls
+  them in order.  Blocks are split where lbzip2 splits them by default: the
+  input is divided into chunks of the block size, and a block ends when it is
+  full or when its chunk ends, so that lbzip2 --parallel-files writes the
+  same output as lbzip2 processing one file at a time.
+
+  Decompression: a single worker at a time parses stream headers and
+  retrieves blocks from the input (the sequential part of bzip2 decoding),
+  then any worker decodes and emits retrieved blocks in chunks of limited
+  size.  The block the caller is going to pull next always has priority.
+
+  Worker threads belong to a pool.  Normally each context creates a private
+  pool, but several contexts can share one pool created by the caller, so
+  that many small streams processed at the same time don't need a thread set
+  each.  All contexts in a pool are protected by the pool lock.  Workers scan
+  contexts in creation order, so older streams are finished first, while
+  idle workers take up blocks of newer ones.
+*/
+
+
+/* Error-checking POSIX thread macros, see process.c. */
+#define xjoin(t)      ((void)(pthread_join((t), NULL)    && (abort(), 0)))
+#define xlock(m)      ((void)(pthread_mutex_lock(m)      && (abort(), 0)))
+#define xunlock(m)    ((void)(pthread_mutex_unlock(m)    && (abort(), 0)))
+#define xwait(c,m)    ((void)(pthread_cond_wait((c),(m)) && (abort(), 0)))
+#define xsignal(c)    ((void)(pthread_cond_signal(c)     && (abort(), 0)))
+#define xbroadcast(c) ((void)(pthread_cond_broadcast(c)  && (abort(), 0)))
+
+/* Size of output chunks produced by emit(). */
+#define OUT_CHUNK 900000u
+
+/* Amount of compressed input buffered per worker thread. */
+#define IN_LIMIT (1u << 20)
+
+/* Number of unconsumed output chunks the head block and other blocks may
+   have, respectively. */
+#define HEAD_CHUNKS 2u
+#define TAIL_CHUNKS 1u
+
+
+/* Memory allocation failures are not recoverable -- the kernels have no way
+   of reporting them -- so the library aborts just like lbzip2 exits.  When
+   the engine is linked into lbzip2 itself, the program's xmalloc() is used.
+*/
+#ifndef LBZIP2_PROGRAM
+void *
+xmalloc(size_t size)
+{
+  void *p = malloc(size);
+
+  if (p == NULL)
+    abort();
+
+  return p;
+}
+#endif
+
+
+struct chunk {
+  struct chunk *next;
+  size_t size;                  /* number of bytes in data */
+  size_t pos;                   /* number of bytes already pulled */
+  uint32_t data[];
+};
+
+struct job {
+  struct job *next;             /* next job in output order */
+  int status;                   /* MORE while in progress, then OK or error */
+  bool busy;                    /* a worker is running this job */
+  bool retrieved;               /* block is ready to be decoded */
+  bool decoded;
+  unsigned chunks;              /* number of chunks in output queue */
+  struct chunk *head;           /* output queue */
+  struct chunk **tail;
+  uint32_t crc;                 /* block CRC */
+  unsigned max_size;            /* maximal decompressed block size */
+  struct encoder_state *enc;
+  struct decoder_state ds;
+};
+
+struct lbzip2_pool {
+  unsigned num_thr;
+  pthread_t *threads;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;     /* signaled when there may be work to do */
+  bool closing;                 /* lbzip2_pool_destroy() was called */
+  bool shared;                  /* created by lbzip2_pool_create() */
+
+  struct lbzip2_ctx *ctxs;      /* contexts in creation order */
+  struct lbzip2_ctx **ctx_tail;
+  unsigned jobs;                /* number of jobs of all contexts */
+  unsigned max_jobs;
+};
+
+struct lbzip2_ctx {
+  bool decompress;
+  unsigned bs100k;
+  struct lbzip2_pool *pool;
+  struct lbzip2_ctx *next;      /* next context in the pool */
+  unsigned active;              /* number of workers running this context */
+
+  pthread_mutex_t *lock;        /* the pool lock */
+  pthread_cond_t *work_cond;    /* the pool work condition */
+  pthread_cond_t pull_cond;     /* signaled when there may be output */
+  bool closing;                 /* lbzip2_close() was called */
+  bool finished;                /* lbzip2_finish() was called */
+  bool flushing;                /* lbzip2_flush() was called */
+  const char *error;            /* last error reported */
+
+  struct job *head;             /* jobs in output order */
+  struct job **tail;
+  unsigned jobs;                /* number of jobs in the list */
+  unsigned max_jobs;
+
+  /* Stream header and trailer (compression only). */
+  uint8_t small[HEADER_SIZE + TRAILER_SIZE];
+  unsigned small_len;
+  unsigned small_pos;
+  bool header_done;
+  bool trailer_done;
+  uint32_t combined_crc;
+
+  /* Block being collected (compression only). */
+  struct encoder_state *enc;
+  size_t collected;
+  size_t chunk_left;            /* input bytes left in the current chunk */
+
+  /* Sequential stage (decompression only). */
+  uint8_t magic[4];
+  unsigned magic_len;
+  bool magic_checked;
+  uint8_t stash[4];             /* input bytes not forming a full word */
+  unsigned stash_len;
+  unsigned eof_missing;         /* zero bytes padding the last word */
+  struct chunk *in_head;        /* input queue */
+  struct chunk **in_tail;
+  struct chunk *cur;            /* input chunk being parsed */
+  size_t in_bytes;              /* bytes in input queue and current chunk */
+  size_t in_limit;
+  struct parser_state par;
+  struct bitstream bs;
+  struct job *retr;             /* job being retrieved, if any */
+  bool seq_busy;                /* a worker is running sequential stage */
+  bool parsing_done;            /* end of data or error was reached */
+};
+
+
+static struct job *
+new_job(struct lbzip2_ctx *ctx)
+{
+  struct job *job = XMALLOC(struct job);
+
+  job->next = NULL;
+  job->status = MORE;
+  job->busy = false;
+  job->retrieved = false;
+  job->decoded = false;
+  job->chunks = 0;
+  job->head = NULL;
+  job->tail = &job->head;
+  job->enc = NULL;
+
+  *ctx->tail = job;
+  ctx->tail = &job->next;
+  ctx->jobs++;
+  ctx->pool->jobs++;
+
+  return job;
+}
+
+/* Return true iff another job can be started.  A context may always have
+   one job, so that it makes progress however busy other contexts in the pool
+   are. */
+static bool
+may_add_job(const struct lbzip2_ctx *ctx)
+{
+  return (ctx->jobs == 0 ||
+          (ctx->jobs < ctx->max_jobs &&
+           ctx->pool->jobs < ctx->pool->max_jobs));
+}
+
+static void
+free_job(struct lbzip2_ctx *ctx, struct job *job)
+{
+  struct chunk *ch;
+
+  while ((ch = job->head) != NULL) {
+    job->head = ch->next;
+    free(ch);
+  }
+
+  /* Decoder state is allocated from the moment the parser finds a block
+     until the block is completely emitted or fails. */
+  if (ctx->decompress && job->status == MORE)
+    decoder_free(&job->ds);
+  free(job->enc);
+  free(job);
+}
+
+static void
+append_chunk(struct job *job, struct chunk *ch)
+{
+  ch->next = NULL;
+  ch->pos = 0;
+  *job->tail = ch;
+  job->tail = &ch->next;
+  job->chunks++;
+}
+
+
+/* Encode and transmit a block collected by lbzip2_push(). */
+static bool
+compress_step(struct lbzip2_ctx *ctx)
+{
+  struct job *job;
+  struct chunk *ch;
+  size_t size;
+  uint32_t crc;
+
+  for (job = ctx->head; job != NULL; job = job->next)
+    if (job->status == MORE && !job->busy)
+      break;
+  if (job == NULL)
+    return false;
+
+  job->busy = true;
+  xunlock(ctx->lock);
+
+  size = encode(job->enc, &crc);
+  ch = xmalloc(sizeof(struct chunk) + size + TRANSMIT_SLACK);
+  ch->size = size;
+  transmit(job->enc, ch->data);
+  free(job->enc);
+  job->enc = NULL;
+
+  xlock(ctx->lock);
+  job->busy = false;
+  job->crc = crc;
+  job->status = OK;
+  append_chunk(job, ch);
+  xsignal(&ctx->pull_cond);
+
+  return true;
+}
+
+
+/* Release all buffered compressed input.  Called once the sequential stage
+   won't need it any longer. */
+static void
+release_input(struct lbzip2_ctx *ctx)
+{
+  struct chunk *ch;
+
+  free(ctx->cur);
+  ctx->cur = NULL;
+  while ((ch = ctx->in_head) != NULL) {
+    ctx->in_head = ch->next;
+    free(ch);
+  }
+  ctx->in_tail = &ctx->in_head;
+  ctx->in_bytes = 0;
+
+  ctx->bs.data = NULL;
+  ctx->bs.limit = NULL;
+  ctx->bs.eof = true;
+}
+
+/* Stop parsing, possibly because of an error. */
+static void
+parsing_done(struct lbzip2_ctx *ctx, int err)
+{
+  ctx->parsing_done = true;
+  release_input(ctx);
+
+  if (err != OK)
+    new_job(ctx)->status = err;
+
+  xsignal(&ctx->pull_cond);
+}
+
+static bool
+can_advance(const struct lbzip2_ctx *ctx)
+{
+  if (ctx->seq_busy || ctx->parsing_done || !ctx->magic_checked)
+    return false;
+  if (ctx->retr == NULL && !may_add_job(ctx))
+    return false;
+
+  return (ctx->bs.data != ctx->bs.limit || ctx->bs.eof ||
+          ctx->in_head != NULL || ctx->finished);
+}
+
+/* Run the parser or retriever until it needs more input or a block is
+   retrieved. */
+static void
+advance(struct lbzip2_ctx *ctx)
+{
+  struct job *job;
+  struct header hdr;
+  unsigned garbage;
+  bool at_tail;
+  int rv;
+
+  /* Attach the next input chunk to the bitstream. */
+  if (ctx->bs.data == ctx->bs.limit && !ctx->bs.eof) {
+    assert(ctx->cur == NULL);
+    if (ctx->in_head != NULL) {
+      ctx->cur = ctx->in_head;
+      ctx->in_head = ctx->cur->next;
+      if (ctx->in_head == NULL)
+        ctx->in_tail = &ctx->in_head;
+      ctx->bs.data = ctx->cur->data;
+      ctx->bs.limit = ctx->cur->data + ctx->cur->size / 4;
+    }
+    else {
+      assert(ctx->finished);
+      ctx->bs.eof = true;
+    }
+  }
+
+  job = ctx->retr;
+  ctx->seq_busy = true;
+  xunlock(ctx->lock);
+
+  if (job == NULL)
+    rv = parse(&ctx->par, &hdr, &ctx->bs, &garbage);
+  else
+    rv = retrieve(&job->ds, &ctx->bs);
+
+  xlock(ctx->lock);
+  ctx->seq_busy = false;
+
+  /* Release input chunk as soon as it's consumed, so that the caller can
+     push more. */
+  if (ctx->bs.data == ctx->bs.limit && ctx->cur != NULL) {
+    ctx->in_bytes -= ctx->cur->size;
+    free(ctx->cur);
+    ctx->cur = NULL;
+    xsignal(&ctx->pull_cond);
+  }
+
+  if (rv == MORE) {
+    /* The caller may be waiting for all input to be processed. */
+    if (ctx->flushing)
+      xsignal(&ctx->pull_cond);
+    return;
+  }
+
+  if (job == NULL) {
+    if (rv == OK) {
+      job = new_job(ctx);
+      decoder_init(&job->ds);
+      job->crc = hdr.crc;
+      job->max_size = hdr.bs100k * 100000u;
+      ctx->retr = job;
+      return;
+    }
+
+    if (rv == FINISH) {
+      /* Bits that were left after end of stream can't have come from zero
+         padding of the last input word. */
+      assert(garbage <= 32);
+      at_tail = (ctx->bs.eof ||
+                 (ctx->finished && ctx->in_head == NULL &&
+                  ctx->bs.data == ctx->bs.limit));
+      if (at_tail && ctx->bs.live + garbage < 8u * ctx->eof_missing)
+        rv = ERR_EOF;
+      else
+        rv = OK;
+    }
+
+    parsing_done(ctx, rv);
+    return;
+  }
+
+  ctx->retr = NULL;
+  if (rv == OK && job->ds.block_size > job->max_size)
+    rv = ERR_OVERFLOW;
+  if (rv != OK) {
+    decoder_free(&job->ds);
+    job->status = rv;
+    parsing_done(ctx, OK);
+    return;
+  }
+
+  job->retrieved = true;
+  xsignal(ctx->work_cond);
+}
+
+static bool
+can_emit(const struct lbzip2_ctx *ctx, const struct job *job)
+{
+  return (job->retrieved && !job->busy && job->status == MORE &&
+          job->chunks < (job == ctx->head ? HEAD_CHUNKS : TAIL_CHUNKS));
+}
+
+/* Decode retrieved block if that wasn't done yet and emit one chunk of its
+   data. */
+static void
+emit_chunk(struct lbzip2_ctx *ctx, struct job *job)
+{
+  struct chunk *ch;
+  size_t vacant;
+  int rv;
+
+  job->busy = true;
+  xunlock(ctx->lock);
+
+  if (!job->decoded) {
+    decode(&job->ds);
+    job->decoded = true;
+  }
+
+  ch = xmalloc(sizeof(struct chunk) + OUT_CHUNK);
+  vacant = OUT_CHUNK;
+  rv = emit(&job->ds, ch->data, &vacant);
+  ch->size = OUT_CHUNK - vacant;
+  if (rv == OK && job->ds.crc != job->crc)
+    rv = ERR_BLKCRC;
+  if (rv != MORE)
+    decoder_free(&job->ds);
+
+  xlock(ctx->lock);
+  job->busy = false;
+  job->status = rv;
+  if (ch->size > 0)
+    append_chunk(job, ch);
+  else
+    free(ch);
+  xsignal(&ctx->pull_cond);
+}
+
+static bool
+expand_step(struct lbzip2_ctx *ctx)
+{
+  struct job *job;
+
+  /* The caller is waiting for the head block, so it goes first. */
+  job = ctx->head;
+  if (job != NULL && can_emit(ctx, job)) {
+    emit_chunk(ctx, job);
+    return true;
+  }
+
+  if (can_advance(ctx)) {
+    advance(ctx);
+    return true;
+  }
+
+  for (job = ctx->head; job != NULL; job = job->next) {
+    if (can_emit(ctx, job)) {
+      emit_chunk(ctx, job);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static void *
+worker(void *arg)
+{
+  struct lbzip2_pool *pool = arg;
+  struct lbzip2_ctx *ctx;
+  bool found;
+
+  xlock(&pool->lock);
+
+  while (!pool->closing) {
+    found = false;
+    for (ctx = pool->ctxs; ctx != NULL && !found; ctx = ctx->next) {
+      if (ctx->closing)
+        continue;
+
+      /* The context can't go away while a step releases the lock. */
+      ctx->active++;
+      found = ctx->decompress ? expand_step(ctx) : compress_step(ctx);
+      ctx->active--;
+      if (ctx->closing && ctx->active == 0)
+        xbroadcast(&ctx->pull_cond);
+    }
+    if (!found)
+      xwait(&pool->work_cond, &pool->lock);
+  }
+
+  xunlock(&pool->lock);
+  return NULL;
+}
+
+
+/*
+  The private pool of the last closed context is kept, with its threads
+  waiting for work, and reused by the next context asking for the same
+  number of threads.  Programs that create a context for each small piece of
+  data, such as users of BZ2_bzBuffToBuffCompress(), then don't pay for
+  thread creation every time.
+
+  A child process created with fork() has none of the threads of the kept
+  pool, so the pool is forgotten in the child, without joining or freeing
+  anything, and the child creates a new one when it needs it.
+*/
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t idle_once = PTHREAD_ONCE_INIT;
+static struct lbzip2_pool *idle_pool;
+
+static void
+idle_prepare(void)
+{
+  xlock(&idle_lock);
+}
+
+static void
+idle_parent(void)
+{
+  xunlock(&idle_lock);
+}
+
+static void
+idle_child(void)
+{
+  idle_pool = NULL;
+  xunlock(&idle_lock);
+}
+
+static void
+idle_init(void)
+{
+  if (pthread_atfork(idle_prepare, idle_parent, idle_child) != 0)
+    abort();
+}
+
+static struct lbzip2_pool *
+create_pool(unsigned threads, bool shared)
+{
+  struct lbzip2_pool *pool;
+  unsigned i;
+
+  if (threads == 0) {
+    long num_online = -1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    num_online = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    threads = num_online < 1 ? 1u : (unsigned)min(num_online, 4096L);
+  }
+
+  if (!shared) {
+    xlock(&idle_lock);
+    pool = idle_pool;
+    if (pool != NULL && pool->num_thr == threads)
+      idle_pool = NULL;
+    else
+      pool = NULL;
+    xunlock(&idle_lock);
+
+    if (pool != NULL)
+      return pool;
+  }
+
+  pool = XMALLOC(struct lbzip2_pool);
+  pool->num_thr = threads;
+  pool->closing = false;
+  pool->shared = shared;
+  pool->ctxs = NULL;
+  pool->ctx_tail = &pool->ctxs;
+  pool->jobs = 0;
+  pool->max_jobs = 2 * threads;
+
+  if (pthread_mutex_init(&pool->lock, NULL) != 0 ||
+      pthread_cond_init(&pool->work_cond, NULL) != 0)
+    abort();
+
+  pool->threads = XNMALLOC(threads, pthread_t);
+  for (i = 0; i < threads; i++)
+    if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0)
+      abort();
+
+  return pool;
+}
+
+struct lbzip2_pool *
+lbzip2_pool_create(unsigned threads)
+{
+  return create_pool(threads, true);
+}
+
+void
+lbzip2_pool_destroy(struct lbzip2_pool *pool)
+{
+  unsigned i;
+
+  if (pool == NULL)
+    return;
+
+  xlock(&pool->lock);
+  assert(pool->ctxs == NULL);
+  pool->closing = true;
+  xbroadcast(&pool->work_cond);
+  xunlock(&pool->lock);
+
+  for (i = 0; i < pool->num_thr; i++)
+    xjoin(pool->threads[i]);
+  free(pool->threads);
+
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+/* Keep a private pool for reuse, or destroy it if another one is kept. */
+static void
+release_pool(struct lbzip2_pool *pool)
+{
+  if (pthread_once(&idle_once, idle_init) != 0)
+    abort();
+
+  xlock(&idle_lock);
+  if (idle_pool == NULL) {
+    idle_pool = pool;
+    pool = NULL;
+  }
+  xunlock(&idle_lock);
+
+  lbzip2_pool_destroy(pool);
+}
+
+#if defined(__GNUC__) && !defined(LBZIP2_PROGRAM)
+/* Stop the threads of the kept pool before the library is unloaded. */
+__attribute__((destructor))
+static void
+destroy_idle_pool(void)
+{
+  lbzip2_pool_destroy(idle_pool);
+  idle_pool = NULL;
+}
+#endif
+
+
+static struct lbzip2_ctx *
+create(struct lbzip2_pool *pool, bool decompress, unsigned bs100k)
+{
+  struct lbzip2_ctx *ctx;
+
+  ctx = XMALLOC(struct lbzip2_ctx);
+  memset(ctx, 0, sizeof(*ctx));
+
+  ctx->decompress = decompress;
+  ctx->bs100k = bs100k;
+  ctx->chunk_left = bs100k * 100000u;
+  ctx->pool = pool;
+  ctx->lock = &pool->lock;
+  ctx->work_cond = &pool->work_cond;
+  ctx->tail = &ctx->head;
+  ctx->max_jobs = 2 * pool->num_thr;
+  ctx->in_tail = &ctx->in_head;
+  ctx->in_limit = (size_t)pool->num_thr * IN_LIMIT;
+  ctx->bs.data = NULL;
+  ctx->bs.limit = NULL;
+  ctx->retr = NULL;
+
+  if (pthread_cond_init(&ctx->pull_cond, NULL) != 0)
+    abort();
+
+  xlock(&pool->lock);
+  *pool->ctx_tail = ctx;
+  pool->ctx_tail = &ctx->next;
+  xunlock(&pool->lock);
+
+  return ctx;
+}
+
+struct lbzip2_ctx *
+lbzip2_compress_init(unsigned threads, unsigned bs100k)
+{
+  if (bs100k < 1 || bs100k > 9)
+    return NULL;
+
+  return create(create_pool(threads, false), false, bs100k);
+}
+
+struct lbzip2_ctx *
+lbzip2_decompress_init(unsigned threads)
+{
+  return create(create_pool(threads, false), true, 0);
+}
+
+struct lbzip2_ctx *
+lbzip2_compress_init_pool(struct lbzip2_pool *pool, unsigned bs100k)
+{
+  if (pool == NULL || bs100k < 1 || bs100k > 9)
+    return NULL;
+
+  return create(pool, false, bs100k);
+}
+
+struct lbzip2_ctx *
+lbzip2_decompress_init_pool(struct lbzip2_pool *pool)
+{
+  if (pool == NULL)
+    return NULL;
+
+  return create(pool, true, 0);
+}
+
+
+static void
+submit_block(struct lbzip2_ctx *ctx)
+{
+  struct job *job;
+
+  job = new_job(ctx);
+  job->enc = ctx->enc;
+  ctx->enc = NULL;
+  xsignal(ctx->work_cond);
+}
+
+static void
+compress_push(struct lbzip2_ctx *ctx, const uint8_t *buf, size_t *size)
+{
+  size_t avail = *size;
+  size_t left;
+  size_t taken;
+  bool full;
+
+  while (avail > 0) {
+    if (ctx->enc == NULL) {
+      if (!may_add_job(ctx))
+        break;
+      ctx->enc = xmalloc(encoder_alloc_size(ctx->bs100k * 100000u));
+      encoder_init(ctx->enc, ctx->bs100k * 100000u, CLUSTER_FACTOR);
+      ctx->collected = 0;
+    }
+
+    /* The collecting encoder is private to the caller, so the lock doesn't
+       need to be held here. */
+    xunlock(ctx->lock);
+    taken = min(avail, ctx->chunk_left);
+    left = taken;
+    full = collect(ctx->enc, buf, &left);
+    taken -= left;
+    ctx->collected += taken;
+    ctx->chunk_left -= taken;
+    buf += taken;
+    avail -= taken;
+    xlock(ctx->lock);
+
+    if (ctx->chunk_left == 0) {
+      ctx->chunk_left = ctx->bs100k * 100000u;
+      full = true;
+    }
+    if (full)
+      submit_block(ctx);
+  }
+
+  *size -= avail;
+}
+
+static void
+expand_push(struct lbzip2_ctx *ctx, const uint8_t *buf, size_t *size)
+{
+  const uint8_t *p = buf;
+  size_t avail = *size;
+  size_t take;
+  size_t words;
+  struct chunk *ch;
+
+  /* Data after the end of the last stream is ignored. */
+  if (ctx->parsing_done)
+    return;
+
+  /* The stream header is checked here, the rest of it is left for the
+     parser. */
+  while (ctx->magic_len < 4 && avail > 0) {
+    ctx->magic[ctx->magic_len++] = *p++;
+    avail--;
+  }
+  if (ctx->magic_len == 4 && !ctx->magic_checked) {
+    ctx->magic_checked = true;
+    if (ctx->magic[0] != 0x42 || ctx->magic[1] != 0x5A ||
+        ctx->magic[2] != 0x68 || ctx->magic[3] < 0x31 ||
+        ctx->magic[3] > 0x39) {
+      parsing_done(ctx, ERR_MAGIC);
+      return;
+    }
+    parser_init(&ctx->par, ctx->magic[3] - 0x30, 0);
+  }
+
+  take = 0;
+  if (ctx->in_bytes < ctx->in_limit)
+    take = min(avail, ctx->in_limit - ctx->in_bytes);
+
+  /* The bitstream is read in whole 32-bit words. */
+  words = (ctx->stash_len + take) / 4;
+  if (words > 0) {
+    ch = xmalloc(sizeof(struct chunk) + 4 * words);
+    ch->size = 4 * words;
+    memcpy(ch->data, ctx->stash, ctx->stash_len);
+    memcpy((uint8_t *)ch->data + ctx->stash_len, p,
+           ch->size - ctx->stash_len);
+    p += ch->size - ctx->stash_len;
+    take -= ch->size - ctx->stash_len;
+    avail -= ch->size - ctx->stash_len;
+    ctx->stash_len = 0;
+
+    ch->next = NULL;
+    *ctx->in_tail = ch;
+    ctx->in_tail = &ch->next;
+    ctx->in_bytes += ch->size;
+    xsignal(ctx->work_cond);
+  }
+  memcpy(ctx->stash + ctx->stash_len, p, take);
+  ctx->stash_len += take;
+  avail -= take;
+
+  *size -= avail;
+}
+
+int
+lbzip2_push(struct lbzip2_ctx *ctx, const void *buf, size_t *size)
+{
+  if (ctx == NULL || size == NULL || (buf == NULL && *size > 0))
+    return LBZIP2_EINVAL;
+
+  xlock(ctx->lock);
+
+  if (ctx->finished) {
+    xunlock(ctx->lock);
+    *size = 0;
+    return LBZIP2_EINVAL;
+  }
+
+  if (ctx->decompress)
+    expand_push(ctx, buf, size);
+  else
+    compress_push(ctx, buf, size);
+  if (*size > 0)
+    ctx->flushing = false;
+
+  xunlock(ctx->lock);
+  return LBZIP2_OK;
+}
+
+
+int
+lbzip2_finish(struct lbzip2_ctx *ctx)
+{
+  struct chunk *ch;
+
+  if (ctx == NULL)
+    return LBZIP2_EINVAL;
+
+  xlock(ctx->lock);
+
+  if (ctx->finished) {
+    xunlock(ctx->lock);
+    return LBZIP2_EINVAL;
+  }
+  ctx->finished = true;
+
+  if (!ctx->decompress) {
+    if (ctx->enc != NULL && ctx->collected > 0) {
+      submit_block(ctx);
+    }
+    else {
+      free(ctx->enc);
+      ctx->enc = NULL;
+    }
+  }
+  else if (!ctx->parsing_done) {
+    if (!ctx->magic_checked) {
+      parsing_done(ctx, ERR_MAGIC);
+    }
+    else if (ctx->stash_len > 0) {
+      /* Pad the last word with zeros.  The parser is told how many padding
+         bytes there are, so it can detect truncated input. */
+      ch = xmalloc(sizeof(struct chunk) + 4);
+      ch->size = 4;
+      memset(ch->data, 0, 4);
+      memcpy(ch->data, ctx->stash, ctx->stash_len);
+      ctx->eof_missing = 4 - ctx->stash_len;
+      ctx->stash_len = 0;
+
+      ch->next = NULL;
+      *ctx->in_tail = ch;
+      ctx->in_tail = &ch->next;
+      ctx->in_bytes += ch->size;
+    }
+  }
+
+  xbroadcast(ctx->work_cond);
+  xunlock(ctx->lock);
+  return LBZIP2_OK;
+}
+
+
+int
+lbzip2_flush(struct lbzip2_ctx *ctx)
+{
+  if (ctx == NULL)
+    return LBZIP2_EINVAL;
+
+  xlock(ctx->lock);
+
+  if (!ctx->decompress && ctx->enc != NULL && ctx->collected > 0)
+    submit_block(ctx);
+  ctx->flushing = true;
+
+  xunlock(ctx->lock);
+  return LBZIP2_OK;
+}
+
+
+int
+lbzip2_stream_end(struct lbzip2_ctx *ctx)
+{
+  struct parser_state par;
+  struct bitstream bs;
+  struct header hdr;
+  uint32_t word;
+  unsigned garbage;
+  bool rv;
+
+  if (ctx == NULL || !ctx->decompress)
+    return 0;
+
+  xlock(ctx->lock);
+
+  if (ctx->parsing_done) {
+    rv = ctx->head == NULL;
+  }
+  else if (ctx->head != NULL || ctx->seq_busy || !ctx->magic_checked ||
+           ctx->in_head != NULL || ctx->bs.data != ctx->bs.limit) {
+    rv = false;
+  }
+  else {
+    /* Let a copy of the parser see end of input, with the incomplete last
+       word padded as lbzip2_finish() would do.  The input ends on a stream
+       boundary iff nothing but the padding is left after end of stream. */
+    par = ctx->par;
+    bs = ctx->bs;
+    word = 0;
+    memcpy(&word, ctx->stash, ctx->stash_len);
+    bs.block = NULL;
+    bs.data = &word;
+    bs.limit = &word + (ctx->stash_len > 0);
+    bs.eof = true;
+
+    rv = (parse(&par, &hdr, &bs, &garbage) == FINISH &&
+          bs.live + garbage == 8u * ((4 - ctx->stash_len) % 4));
+  }
+
+  xunlock(ctx->lock);
+  return rv;
+}
+
+
+static void
+make_trailer(struct lbzip2_ctx *ctx)
+{
+  uint8_t *buffer = ctx->small + ctx->small_len;
+
+  buffer[0] = 0x17;
+  buffer[1] = 0x72;
+  buffer[2] = 0x45;
+  buffer[3] = 0x38;
+  buffer[4] = 0x50;
+  buffer[5] = 0x90;
+  buffer[6] = ctx->combined_crc >> 24;
+  buffer[7] = (ctx->combined_crc >> 16) & 0xFF;
+  buffer[8] = (ctx->combined_crc >> 8) & 0xFF;
+  buffer[9] = ctx->combined_crc & 0xFF;
+  ctx->small_len += TRAILER_SIZE;
+}
+
+/* Return true iff no more output can be produced without more input. */
+static bool
+drained(const struct lbzip2_ctx *ctx)
+{
+  if (!ctx->decompress)
+    return ctx->head == NULL;
+
+  return ((ctx->head == NULL || ctx->head == ctx->retr) &&
+          !ctx->seq_busy && !can_advance(ctx));
+}
+
+static bool
+can_push(const struct lbzip2_ctx *ctx)
+{
+  if (ctx->finished)
+    return false;
+  if (ctx->decompress)
+    return ctx->parsing_done || ctx->in_bytes < ctx->in_limit;
+  return ctx->enc != NULL || may_add_job(ctx);
+}
+
+int
+lbzip2_pull(struct lbzip2_ctx *ctx, void *buf, size_t *size)
+{
+  uint8_t *p = buf;
+  size_t avail;
+  size_t n;
+  struct job *job;
+  struct chunk *ch;
+  int rv = LBZIP2_OK;
+
+  if (ctx == NULL || size == NULL || (buf == NULL && *size > 0))
+    return LBZIP2_EINVAL;
+
+  avail = *size;
+  xlock(ctx->lock);
+
+  if (!ctx->decompress && !ctx->header_done) {
+    ctx->small[0] = 0x42;
+    ctx->small[1] = 0x5A;
+    ctx->small[2] = 0x68;
+    ctx->small[3] = 0x30 + ctx->bs100k;
+    ctx->small_len = HEADER_SIZE;
+    ctx->header_done = true;
+  }
+
+  while (avail > 0) {
+    if (ctx->small_pos < ctx->small_len) {
+      n = min(avail, ctx->small_len - ctx->small_pos);
+      memcpy(p, ctx->small + ctx->small_pos, n);
+      ctx->small_pos += n;
+      p += n;
+      avail -= n;
+      continue;
+    }
+
+    job = ctx->head;
+
+    if (job != NULL && (ch = job->head) != NULL) {
+      n = min(avail, ch->size - ch->pos);
+      memcpy(p, (uint8_t *)ch->data + ch->pos, n);
+      ch->pos += n;
+      p += n;
+      avail -= n;
+      if (ch->pos == ch->size) {
+        job->head = ch->next;
+        if (job->head == NULL)
+          job->tail = &job->head;
+        job->chunks--;
+        free(ch);
+        xsignal(ctx->work_cond);
+      }
+      continue;
+    }
+
+    if (job != NULL && job->status == OK) {
+      ctx->head = job->next;
+      if (ctx->head == NULL)
+        ctx->tail = &ctx->head;
+      ctx->jobs--;
+      ctx->pool->jobs--;
+      ctx->combined_crc = combine_crc(ctx->combined_crc, job->crc);
+      free_job(ctx, job);
+      xsignal(ctx->work_cond);
+      continue;
+    }
+
+    if (job != NULL && job->status != MORE) {
+      /* The error is reported after all data preceding it. */
+      if (p == buf) {
+        ctx->error = err2str(job->status);
+        rv = (job->status == ERR_MAGIC ? LBZIP2_EMAGIC :
+              job->status == ERR_EOF ? LBZIP2_EEOF : LBZIP2_EDATA);
+      }
+      break;
+    }
+
+    if (job == NULL && ctx->finished && !ctx->decompress) {
+      if (!ctx->trailer_done) {
+        ctx->small_len = ctx->small_pos = 0;
+        make_trailer(ctx);
+        ctx->trailer_done = true;
+        continue;
+      }
+      rv = LBZIP2_END;
+      break;
+    }
+
+    if (job == NULL && ctx->parsing_done) {
+      rv = LBZIP2_END;
+      break;
+    }
+
+    if (p != buf || (can_push(ctx) && (!ctx->flushing || drained(ctx))))
+      break;
+
+    xwait(&ctx->pull_cond, ctx->lock);
+  }
+
+  xunlock(ctx->lock);
+  *size = p - (uint8_t *)buf;
+  return rv;
+}
+
+
+const char *
+lbzip2_error(const struct lbzip2_ctx *ctx)
+{
+  return ctx != NULL ? ctx->error : NULL;
+}
+
+
+void
+lbzip2_close(struct lbzip2_ctx *ctx)
+{
+  struct lbzip2_pool *pool;
+  struct lbzip2_ctx **link;
+  struct job *job;
+
+  if (ctx == NULL)
+    return;
+
+  pool = ctx->pool;
+  xlock(&pool->lock);
+  ctx->closing = true;
+  while (ctx->active > 0)
+    xwait(&ctx->pull_cond, &pool->lock);
+
+  for (link = &pool->ctxs; *link != ctx; link = &(*link)->next)
+    ;
+  *link = ctx->next;
+  if (pool->ctx_tail == &ctx->next)
+    pool->ctx_tail = link;
+  pool->jobs -= ctx->jobs;
+  xbroadcast(&pool->work_cond);
+  xunlock(&pool->lock);
+
+  while ((job = ctx->head) != NULL) {
+    ctx->head = job->next;
+    free_job(ctx, job);
+  }
+  free(ctx->enc);
+  release_input(ctx);
+
+  pthread_cond_destroy(&ctx->pull_cond);
+  if (!pool->shared)
+    release_pool(pool);
+  free(ctx);
+}
@@ -0,0 +1,157 @@
+/*-
+  liblbzip2.h -- embeddable parallel bzip2 compressor and decompressor
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBLBZIP2_H
+#define LIBLBZIP2_H
+
+#include <stddef.h>             /* size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef LBZIP2_API
+# if defined(__GNUC__) && __GNUC__ >= 4
+#  define LBZIP2_API __attribute__((visibility("default")))
+# else
+#  define LBZIP2_API
+# endif
+#endif
+
+
+/*
+  Streaming interface.
+
+  A context compresses or decompresses a single data stream.  The caller
+  pushes input with lbzip2_push() and pulls output with lbzip2_pull(); the
+  heavy lifting is done by a pool of worker threads, which is either owned by
+  the context or shared with other contexts.
+  After the last input has been pushed the caller calls lbzip2_finish() and
+  keeps pulling until LBZIP2_END is returned.
+
+  A context may be used by one thread at a time.  Distinct contexts are
+  completely independent and may be used concurrently.
+
+  A typical loop looks like this:
+
+    while (have input) {
+      size_t n = avail;
+      lbzip2_push(ctx, in, &n);           consumes up to AVAIL bytes
+      in += n, avail -= n;
+      do { size_t m = sizeof out;
+           rv = lbzip2_pull(ctx, out, &m); write M bytes of OUT
+      } while (rv == LBZIP2_OK && m > 0);
+    }
+    lbzip2_finish(ctx);
+    pull until LBZIP2_END or an error
+*/
+
+struct lbzip2_ctx;
+struct lbzip2_pool;
+
+/* Return codes. */
+#define LBZIP2_OK       0       /* success */
+#define LBZIP2_END      1       /* all output has been pulled */
+#define LBZIP2_EINVAL (-1)      /* invalid argument or call sequence */
+#define LBZIP2_EDATA  (-2)      /* compressed data is corrupt */
+#define LBZIP2_EMAGIC (-3)      /* input is not in bzip2 format */
+#define LBZIP2_EEOF   (-4)      /* compressed data ends prematurely */
+
+/* Create a compression context producing a single bzip2 stream with block
+   size BS100K * 100 kB (1..9).  THREADS is the number of worker threads; 0
+   selects the number of online processors.  Return NULL on invalid
+   arguments. */
+LBZIP2_API struct lbzip2_ctx *
+lbzip2_compress_init(unsigned threads, unsigned bs100k);
+
+/* Create a decompression context.  Concatenated bzip2 streams are
+   decompressed as one.  THREADS has the same meaning as above. */
+LBZIP2_API struct lbzip2_ctx *
+lbzip2_decompress_init(unsigned threads);
+
+/* Create a pool of THREADS worker threads (0 selects the number of online
+   processors) that can be shared by any number of contexts. */
+LBZIP2_API struct lbzip2_pool *
+lbzip2_pool_create(unsigned threads);
+
+/* Like lbzip2_compress_init() and lbzip2_decompress_init(), but run the
+   context on the worker threads of POOL.  Contexts sharing a pool may still
+   be used concurrently by different threads; the pool gives priority to the
+   contexts that were created first and limits the number of blocks in
+   progress across all of them. */
+LBZIP2_API struct lbzip2_ctx *
+lbzip2_compress_init_pool(struct lbzip2_pool *pool, unsigned bs100k);
+LBZIP2_API struct lbzip2_ctx *
+lbzip2_decompress_init_pool(struct lbzip2_pool *pool);
+
+/* Stop the worker threads of POOL and release it.  All contexts using the
+   pool must have been closed. */
+LBZIP2_API void
+lbzip2_pool_destroy(struct lbzip2_pool *pool);
+
+/* Offer *SIZE bytes of input.  On return *SIZE is the number of bytes that
+   were accepted, which can be less than offered (even zero) if the context
+   holds as much unprocessed data as it is willing to; pull some output and
+   push the rest again.  Returns LBZIP2_OK, or an error code. */
+LBZIP2_API int
+lbzip2_push(struct lbzip2_ctx *ctx, const void *buf, size_t *size);
+
+/* Signal that no more input follows. */
+LBZIP2_API int
+lbzip2_finish(struct lbzip2_ctx *ctx);
+
+/* Make all output that can be produced from input pushed so far available.
+   When compressing, this ends the current block early.  Until more input is
+   pushed, lbzip2_pull() returns LBZIP2_OK with *SIZE == 0 only after all
+   such output has been pulled. */
+LBZIP2_API int
+lbzip2_flush(struct lbzip2_ctx *ctx);
+
+/* When decompressing, return nonzero iff the input pushed so far consists of
+   complete bzip2 streams and all their output has been pulled.  This allows
+   to find stream boundaries without calling lbzip2_finish(). */
+LBZIP2_API int
+lbzip2_stream_end(struct lbzip2_ctx *ctx);
+
+/* Store up to *SIZE bytes of output in BUF and set *SIZE to the number of
+   bytes stored.  Blocks only if no output is ready and the context can't
+   accept more input.  Returns LBZIP2_OK with *SIZE == 0 when more input is
+   needed, LBZIP2_END if the bytes stored (possibly none) end the output, or
+   an error code.  Errors are reported after all output preceding them. */
+LBZIP2_API int
+lbzip2_pull(struct lbzip2_ctx *ctx, void *buf, size_t *size);
+
+/* Describe the last error reported by CTX, or return NULL if there was
+   none. */
+LBZIP2_API const char *
+lbzip2_error(const struct lbzip2_ctx *ctx);
+
+/* Stop worker threads (unless the context uses a shared pool) and release all
+   resources associated with CTX.
+   Can be called at any time, also before the stream is finished. */
+LBZIP2_API void
+lbzip2_close(struct lbzip2_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBLBZIP2_H */
@@ -23,6 +23,7 @@
 #include "common.h"
 
 #include <unistd.h>             /* unlink() */
+#include <limits.h>             /* UINT_MAX */
 #include <signal.h>             /* SIGPIPE */
 #include <stdarg.h>             /* va_list */
 #include <stdio.h>              /* vfprintf() */
@@ -30,9 +31,13 @@
 #include <sys/stat.h>           /* lstat() */
 #include <fcntl.h>              /* open() */
 #include <time.h>               /* futimens() */
+#include <pthread.h>            /* pthread_mutex_lock() */
+#include <ftw.h>                /* nftw() */
 
 #include "signals.h"            /* setup_signals() */
 #include "main.h"               /* pname */
+#include "stats.h"              /* stats_run_end() */
+#include "timeline.h"           /* timeline_open() */
 
 
 unsigned num_worker;            /* -n */
@@ -45,13 +50,28 @@ bool verbose;                   /* -v */
 bool print_cctrs;               /* -S */
 bool small;                     /* -s */
 bool ultra;                     /* -u */
+bool dedup;                     /* --dedup */
+unsigned blocks_per_stream;     /* --stream-blocks */
+bool parallel_files;            /* --parallel-files */
+bool recursive;                 /* -r */
+bool stats_json;                /* --stats=json */
+static const char *trace_pathn; /* --trace */
 struct filespec ispec;
 struct filespec ospec;
 
 #define EX_OK   0
 #define EX_WARN 4
 
-static char *opathn;
+/*
+  Output files being written, removed on abnormal termination.  There is a
+  single slot, except with --parallel-files, where each file driver thread
+  has its own.
+*/
+static pthread_mutex_t opathn_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *opathn_single;
+static char **opathn = &opathn_single;
+static unsigned num_opathn = 1u;
+
 static const char *pname;
 static bool warned;
 
@@ -60,16 +80,53 @@ static bool warned;
 void
 cleanup(void)
 {
-  if (opathn != NULL) {
-    (void)unlink(opathn);
-    /*
-       Don't release "opathn" -- the muxer might encounter a write error and
-       access *opathn via "ofmt" for error reporting before the main thread
-       re-raises the signal here. This is a deliberate leak, but we're on
-       our (short) way out anyway. 16-Feb-2010 lacos
-     */
-    opathn = NULL;
+  unsigned i;
+
+  (void)pthread_mutex_lock(&opathn_lock);
+  for (i = 0u; i < num_opathn; ++i) {
+    if (opathn[i] != NULL) {
+      (void)unlink(opathn[i]);
+      /*
+         Don't release "opathn" -- the muxer might encounter a write error
+         and access *opathn via "ofmt" for error reporting before the main
+         thread re-raises the signal here. This is a deliberate leak, but
+         we're on our (short) way out anyway. 16-Feb-2010 lacos
+       */
+      opathn[i] = NULL;
+    }
   }
+  (void)pthread_mutex_unlock(&opathn_lock);
+}
+
+
+char **
+opathn_slots(unsigned n)
+{
+  char **slots;
+  unsigned i;
+
+  assert(1u == num_opathn && NULL == opathn_single);
+
+  slots = XNMALLOC(n, char *);
+  for (i = 0u; i < n; ++i) {
+    slots[i] = NULL;
+  }
+
+  (void)pthread_mutex_lock(&opathn_lock);
+  opathn = slots;
+  num_opathn = n;
+  (void)pthread_mutex_unlock(&opathn_lock);
+
+  return slots;
+}
+
+
+static void
+opathn_set(char **slot, char *pathn)
+{
+  (void)pthread_mutex_lock(&opathn_lock);
+  *slot = pathn;
+  (void)pthread_mutex_unlock(&opathn_lock);
 }
 
 
@@ -156,7 +213,8 @@ static const char envsep[] = " \t";
 
 
 static uintmax_t
-xstrtol(const char *str, int source, uintmax_t lower, uintmax_t upper)
+xstrtol(const char *str, const char *source, uintmax_t lower,
+        uintmax_t upper)
 {
   long tmp;
   char *endptr;
@@ -185,7 +243,7 @@ xstrtol(const char *str, int source, uintmax_t lower, uintmax_t upper)
 
   if (val < lower || val > upper) {
   fail:
-    fail("failed to parse \"%s\" from \"-%c\" as an integer in [%ju..%ju],"
+    fail("failed to parse \"%s\" from \"%s\" as an integer in [%ju..%ju],"
          " specify \"-h\" for help", str, source, lower, upper);
   }
 
@@ -200,47 +258,66 @@ xstrtol(const char *str, int source, uintmax_t lower, uintmax_t upper)
   To alter the message, simply edit and run pretty-usage.pl. It will patch
   the macro definition automatically.
 */
-#define USAGE_STRING "%s%s%s%s%s%s", "Usage:\n1. PROG [-n WTHRS] [-k|-c|-t] [-\
-d|-z] [-1 .. -9] [-f] [-v] [-S] {FILE}\n2. PROG -h|-V\n\nRecognized PROG names\
-:\n\n  bunzip2, lbunzip2  : Decompress. Forceable with `-d'.\n  bzcat, lbzcat \
-     : Decompress to stdout. Forceable with `-cd'.\n  <otherwise>        : Com\
-press. Forceable with `-z'.\n\nEnvironment variables:\n\n  LBZIP2, BZIP2,\n  B\
-ZIP               : Insert arguments between PROG and the rest of the\n       \
-                command line. Tokens are separated by spaces and tabs;\n      \
-                ", " no escaping.\n\nOptions:\n\n  -n WTHRS           : Set th\
-e number of (de)compressor threads to WTHRS, where\n                       WTH\
-RS is a positive integer.\n  -k, --keep         : Don't remove FILE operands. \
-Open regular input files\n                       with more than one link.\n  -\
-c, --stdout       : Write output to stdout even with FILE operands. Implies\n \
-                      `-k'. Incompatible with `-t'.\n  -t, --test         : Te\
-st decompression; discard output instead of writing it\n                ", "  \
-     to files or stdout. Implies `-k'. Incompatible with\n                    \
-   `-c'.\n  -d, --decompress   : Force decompression over the selection by PRO\
-G.\n  -z, --compress     : Force compression over the selection by PROG.\n  -1\
- .. -9           : Set the compression block size to 100K .. 900K.\n  --fast  \
-           : Alias for `-1'.\n  --best             : Alias for `-9'. This is t\
-he default.\n  -f, --force        : Open non-regular input files. Open input f\
-iles with more\n                       than one", " link. Try to remove each o\
-utput file before\n                       opening it. With `-cd' copy files no\
-t in bzip2 format.\n  -s, --small        : Reduce memory usage at cost of perf\
-ormance.\n  -u, --sequential   : Perform splitting input blocks sequentially. \
-This may\n                       improve compression ratio and decrease CPU us\
-age, but\n                       will degrade scalability.\n  -v, --verbose   \
+#define USAGE_STRING "%s%s%s%s%s%s%s%s%s", "Usage:\n1. PROG [-n WTHRS] [-k|-c|\
+-t] [-d|-z] [-1 .. -9] [-f] [-r] [-v] [-S] {FILE}\n2. PROG -h|-V\n\nRecognized\
+ PROG names:\n\n  bunzip2, lbunzip2  : Decompress. Forceable with `-d'.\n  bzc\
+at, lbzcat      : Decompress to stdout. Forceable with `-cd'.\n  <otherwise>  \
+      : Compress. Forceable with `-z'.\n\nEnvironment variables:\n\n  LBZIP2, \
+BZIP2,\n  BZIP               : Insert arguments between PROG and the rest of t\
+he\n                       command line. Tokens are separated by spaces and ta\
+bs;\n                 ", "      no escaping.\n\nOptions:\n\n  -n WTHRS        \
+   : Set the number of (de)compressor threads to WTHRS, where\n               \
+        WTHRS is a positive integer.\n  -k, --keep         : Don't remove FILE\
+ operands. Open regular input files\n                       with more than one\
+ link.\n  -c, --stdout       : Write output to stdout even with FILE operands.\
+ Implies\n                       `-k'. Incompatible with `-t'.\n  -t, --test  \
+       : Test decompression; discard output instead of writing it\n           \
+", "            to files or stdout. Implies `-k'. Incompatible with\n         \
+              `-c'.\n  -d, --decompress   : Force decompression over the selec\
+tion by PROG.\n  -z, --compress     : Force compression over the selection by \
+PROG.\n  -1 .. -9           : Set the compression block size to 100K .. 900K.\
+\n  --fast             : Alias for `-1'.\n  --best             : Alias for `-9\
+'. This is the default.\n  -f, --force        : Open non-regular input files. \
+Open input files with more\n                       tha", "n one link. Try to r\
+emove each output file before\n                       opening it. With `-cd' c\
+opy files not in bzip2 format.\n  -s, --small        : Reduce memory usage at \
+cost of performance.\n  -u, --sequential   : Perform splitting input blocks se\
+quentially. This may\n                       improve compression ratio and dec\
+rease CPU usage, but\n                       will degrade scalability.\n  --de\
+dup            : Reuse compressed blocks for repeated identical input\n       \
+                blocks. This", " may speed up compression of data containing\n\
+                       large duplicated regions.\n  --stream-blocks=N  : When \
+compressing, write a separate bzip2 stream for\n                       every N\
+ blocks, where N is a positive integer. This\n                       allows ot\
+her tools to split output and decompress parts\n                       of it i\
+n parallel.\n  -r, --recursive    : Process all regular files in directories g\
+iven as FILE\n                       operands, and in their subdirectories. Fi\
+le", "s are\n                       processed as with `--parallel-files', larg\
+est first.\n  --parallel-files   : Process several FILE operands at the same t\
+ime, sharing\n                       the worker threads among them. This speed\
+s up processing\n                       of many small files. Ignored with `-c'\
+, `--dedup' and\n                       `--stream-blocks'.\n  -v, --verbose   \
    : Log each (de)compression start to stderr. Display\n                      \
- compression ratio an", "d space savings. Display progress\n                  \
+ compression ratio and space savings. Display progress", "\n                  \
      information if stderr is connected to a terminal.\n  -S                 :\
- Print condition variable statistics to stderr.\n  -q, --quiet,\n  --repetitiv\
-e-fast,\n  --repetitive-best,\n  --exponential      : Accepted for compatibili\
-ty, otherwise ignored.\n  -h, --help         : Print this help to stdout and e\
-xit.\n  -L, --license, -V,\n  --version          : Print version information t\
-o stdout and exit.\n\nOperands:\n\n  FILE               : Specify files to com\
-p", "ress or decompress. If no FILE is\n                       given, work as \
-a filter. FILEs with `.bz2', `.tbz',\n                       `.tbz2' and `.tz2\
-' name suffixes will be skipped when\n                       compressing. When\
- decompressing, `.bz2' suffixes will be\n                       removed in out\
-put filenames; `.tbz', `.tbz2' and `.tz2'\n                       suffixes wil\
-l be replaced by `.tar'; other filenames\n                       will be suffi\
-xed with `.out'.\n"
+ Print condition variable statistics to stderr.\n  --stats=json       : After \
+each file and at the end of the run, print\n                       statistics \
+as a JSON object on a line of its own to\n                       stderr: bytes\
+, blocks, CPU time of each stage, queue\n                       high-water mar\
+ks, stall counts and wall time.\n  --trace=FILE       : Record the start and e\
+nd time of every task run by", "\n                       worker threads, and o\
+f every read and write, and save\n                       them to FILE in Chrom\
+e trace event format.\n  -q, --quiet,\n  --repetitive-fast,\n  --repetitive-be\
+st,\n  --exponential      : Accepted for compatibility, otherwise ignored.\n  \
+-h, --help         : Print this help to stdout and exit.\n  -L, --license, -V,\
+\n  --version          : Print version information to stdout and exit.\n\nOper\
+ands:\n\n  FILE               : Specify files to compress or decompress. If no\
+ FILE is", "\n                       given, work as a filter. FILEs with `.bz2\
+', `.tbz',\n                       `.tbz2' and `.tz2' name suffixes will be sk\
+ipped when\n                       compressing. When decompressing, `.bz2' suf\
+fixes will be\n                       removed in output filenames; `.tbz', `.t\
+bz2' and `.tz2'\n                       suffixes will be replaced by `.tar'; o\
+ther filenames\n                       will be suffixed with `.out'.\n"
 
 #define HELP_STRING "%s version %s\n%s\n\n%s%s",                        \
     PACKAGE_NAME, PACKAGE_VERSION, "https://github.com/kjn/lbzip2",     \
@@ -285,11 +362,6 @@ version(void)
 }
 
 
-struct arg {
-  struct arg *next;
-  const char *val;
-};
-
 
 static void
 opts_outmode(char ch)
@@ -445,6 +517,29 @@ opts_setup(struct arg **operands, size_t argc, char **argv)
           else if (0 == strcmp("sequential", argscan)) {
             ultra = 1;
           }
+          else if (0 == strcmp("dedup", argscan)) {
+            dedup = 1;
+          }
+          else if (0 == strncmp("stream-blocks=", argscan, 14)) {
+            blocks_per_stream = xstrtol(argscan + 14, "--stream-blocks",
+                                        1, UINT_MAX);
+          }
+          else if (0 == strcmp("recursive", argscan)) {
+            recursive = 1;
+          }
+          else if (0 == strcmp("parallel-files", argscan)) {
+            parallel_files = 1;
+          }
+          else if (0 == strncmp("stats=", argscan, 6)) {
+            if (0 != strcmp("json", argscan + 6)) {
+              fail("unknown statistics format \"%s\", specify \"-h\" for"
+                   " help", argscan + 6);
+            }
+            stats_json = 1;
+          }
+          else if (0 == strncmp("trace=", argscan, 6)) {
+            trace_pathn = argscan + 6;
+          }
           else if (0 == strcmp("verbose", argscan)) {
             verbose = 1;
           }
@@ -513,6 +608,10 @@ opts_setup(struct arg **operands, size_t argc, char **argv)
               ultra = 1;
               break;
 
+            case 'r':
+              recursive = 1;
+              break;
+
             case 'v':
               verbose = 1;
               break;
@@ -555,9 +654,9 @@ opts_setup(struct arg **operands, size_t argc, char **argv)
               }
 
               if (opt == 'n')
-                num_worker = xstrtol(argscan, opt, 1, mx_worker);
+                num_worker = xstrtol(argscan, "-n", 1, mx_worker);
               else
-                max_mem = xstrtol(argscan, opt, 1, SIZE_MAX);
+                max_mem = xstrtol(argscan, "-m", 1, SIZE_MAX);
 
               cont = 0;
               break;
@@ -688,6 +787,148 @@ suffix_xform(const char *compr_pathname, char **decompr_pathname)
 }
 
 
+/*
+  Recursive mode, -r.
+
+  Directory operands are replaced by all regular files found below them;
+  symbolic links are not followed. Files that would only be skipped because
+  of their name -- ones with a compressed suffix when compressing, ones
+  without it when decompressing -- are left out silently. Unless output goes
+  to stdout, where the order of operands matters, the resulting list is
+  sorted by file size, largest first, so that the longest jobs don't end up
+  last when several files are processed at the same time.
+*/
+struct walk_entry {
+  struct arg *arg;
+  off_t size;
+};
+
+static struct walk_entry *walk_tab;
+static size_t walk_len;
+static size_t walk_alloc;
+
+
+static void
+walk_add(struct arg *arg, off_t size)
+{
+  if (walk_len == walk_alloc) {
+    struct walk_entry *tab;
+
+    walk_alloc = walk_alloc ? 2u * walk_alloc : 64u;
+    if (SIZE_MAX / sizeof *tab < walk_alloc) {
+      fail("size_t overflow in walk_add\n");
+    }
+    tab = xmalloc(walk_alloc * sizeof *tab);
+    if (0u < walk_len) {
+      (void)memcpy(tab, walk_tab, walk_len * sizeof *tab);
+    }
+    free(walk_tab);
+    walk_tab = tab;
+  }
+
+  walk_tab[walk_len].arg = arg;
+  walk_tab[walk_len].size = size;
+  ++walk_len;
+}
+
+
+static int
+walk_visit(const char *pathname, const struct stat *sbuf, int type,
+           struct FTW *ftwbuf)
+{
+  struct arg *arg;
+  size_t len;
+
+  (void)ftwbuf;
+
+  switch (type) {
+  case FTW_F:
+    if (!S_ISREG(sbuf->st_mode)
+        || (decompress ? !suffix_xform(pathname, 0)
+            : suffix_xform(pathname, 0))) {
+      break;
+    }
+
+    /* The pathname is stored right after the list element, so that it's
+       released together with it. */
+    len = strlen(pathname);
+    if (SIZE_MAX - sizeof *arg - 1u < len) {
+      fail("\"%s\": size_t overflow in walk_visit\n", pathname);
+    }
+    arg = xmalloc(sizeof *arg + len + 1u);
+    (void)memcpy(arg + 1, pathname, len + 1u);
+    arg->val = (const char *)(arg + 1);
+    walk_add(arg, sbuf->st_size);
+    break;
+
+  case FTW_DNR:
+    warn("skipping \"%s\": can't read directory", pathname);
+    break;
+
+  case FTW_NS:
+    warn("skipping \"%s\": can't stat", pathname);
+    break;
+  }
+
+  return 0;
+}
+
+
+static int
+walk_cmp(const void *va, const void *vb)
+{
+  const struct walk_entry *a = va, *b = vb;
+
+  if (a->size != b->size) {
+    return a->size < b->size ? 1 : -1;
+  }
+
+  return strcmp(a->arg->val, b->arg->val);
+}
+
+
+/* Expand directory operands and return the new list of operands. */
+static struct arg *
+walk_operands(struct arg *operands)
+{
+  struct arg *arg, *next, **link_at;
+  struct stat sbuf;
+  size_t ofs;
+
+  for (arg = operands; 0 != arg; arg = next) {
+    next = arg->next;
+
+    if (-1 != lstat(arg->val, &sbuf) && S_ISDIR(sbuf.st_mode)) {
+      if (-1 == nftw(arg->val, walk_visit, 16, FTW_PHYS)) {
+        warnx(errno, "nftw(\"%s\")", arg->val);
+      }
+      free(arg);
+    }
+    else {
+      /* Other operands are handled (or skipped) as usual. */
+      walk_add(arg, -1 != lstat(arg->val, &sbuf) ? sbuf.st_size : 0);
+    }
+  }
+
+  if (OM_STDOUT != outmode && 1u < walk_len) {
+    qsort(walk_tab, walk_len, sizeof *walk_tab, walk_cmp);
+  }
+
+  link_at = &operands;
+  for (ofs = 0u; ofs < walk_len; ++ofs) {
+    *link_at = walk_tab[ofs].arg;
+    link_at = &walk_tab[ofs].arg->next;
+  }
+  *link_at = 0;
+
+  free(walk_tab);
+  walk_tab = 0;
+  walk_len = walk_alloc = 0u;
+
+  return operands;
+}
+
+
 /*
   If input is unavailable (skipping), return -1.
 
@@ -696,20 +937,20 @@ suffix_xform(const char *compr_pathname, char **decompr_pathname)
     - store the file descriptor to read from (might be -1 if discarding),
     - if input is coming from a successfully opened FILE operand, fill in
       "*sbuf" via fstat() -- but "*sbuf" may be modified without this, too,
-    - set up "ispec.sep" and "ispec.fmt" for logging; the character arrays
+    - set up "is->sep" and "is->fmt" for logging; the character arrays
       pointed to by them won't need to be released (or at least not through
       these aliases).
 */
-static int
-input_init(const struct arg *operand, struct stat *sbuf)
+int
+input_init(struct filespec *is, const struct arg *operand, struct stat *sbuf)
 {
-  ispec.total = 0u;
+  is->total = 0u;
 
   if (0 == operand) {
-    ispec.fd = STDIN_FILENO;
-    ispec.sep = "";
-    ispec.fmt = "stdin";
-    ispec.size = 0u;
+    is->fd = STDIN_FILENO;
+    is->sep = "";
+    is->fmt = "stdin";
+    is->size = 0u;
     return 0;
   }
 
@@ -742,11 +983,11 @@ input_init(const struct arg *operand, struct stat *sbuf)
     }
     else {
       if (-1 != fstat(infd, sbuf)) {
-        ispec.fd = infd;
-        ispec.sep = "\"";
-        ispec.fmt = operand->val;
+        is->fd = infd;
+        is->sep = "\"";
+        is->fmt = operand->val;
         assert(0 <= sbuf->st_size);
-        ispec.size = sbuf->st_size;
+        is->size = sbuf->st_size;
         return 0;
       }
 
@@ -772,11 +1013,11 @@ input_oprnd_rm(const struct arg *operand)
 }
 
 
-static void
-input_uninit(void)
+void
+input_uninit(const struct filespec *is)
 {
-  if (-1 == close(ispec.fd)) {
-    failx(errno, "close(%s%s%s)", ispec.sep, ispec.fmt, ispec.sep);
+  if (-1 == close(is->fd)) {
+    failx(errno, "close(%s%s%s)", is->sep, is->fmt, is->sep);
   }
 }
 
@@ -788,27 +1029,28 @@ input_uninit(void)
     - return 0,
     - store the file descriptor to write to (might be -1 if discarding),
     - if we write to a regular file, store the dynamically allocated output
-      pathname,
-    - set up "ospec.sep" and "ospec.fmt" for logging; the character arrays
+      pathname in "*pathn",
+    - set up "os->sep" and "os->fmt" for logging; the character arrays
       pointed to by them won't need to be released (or at least not through
       these aliases).
 */
-static int
-output_init(const struct arg *operand, const struct stat *sbuf)
+int
+output_init(struct filespec *os, char **pathn, const struct arg *operand,
+            const struct stat *sbuf)
 {
-  ospec.total = 0u;
+  os->total = 0u;
 
   switch (outmode) {
   case OM_STDOUT:
-    ospec.fd = STDOUT_FILENO;
-    ospec.sep = "";
-    ospec.fmt = "stdout";
+    os->fd = STDOUT_FILENO;
+    os->sep = "";
+    os->fmt = "stdout";
     return 0;
 
   case OM_DISCARD:
-    ospec.fd = -1;
-    ospec.sep = "";
-    ospec.fmt = "the bit bucket";
+    os->fd = -1;
+    os->sep = "";
+    os->fmt = "the bit bucket";
     return 0;
 
   case OM_REGF:
@@ -840,17 +1082,17 @@ output_init(const struct arg *operand, const struct stat *sbuf)
         infox(errno, "unlink(\"%s\")", tmp);
       }
 
-      ospec.fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL,
-                       sbuf->st_mode & (S_IRUSR | S_IWUSR));
+      os->fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL,
+                    sbuf->st_mode & (S_IRUSR | S_IWUSR));
 
-      if (-1 == ospec.fd) {
+      if (-1 == os->fd) {
         warnx(errno, "skipping \"%s\": open(\"%s\")", operand->val, tmp);
         free(tmp);
       }
       else {
-        opathn = tmp;
-        ospec.sep = "\"";
-        ospec.fmt = tmp;
+        opathn_set(pathn, tmp);
+        os->sep = "\"";
+        os->fmt = tmp;
         return 0;
       }
     }
@@ -865,8 +1107,10 @@ output_init(const struct arg *operand, const struct stat *sbuf)
 
 
 static void
-output_regf_uninit(int outfd, const struct stat *sbuf)
+output_regf_uninit(int outfd, char **pathn, const struct stat *sbuf)
 {
+  const char *opathn = *pathn;
+
   assert(0 != opathn);
 
   if (-1 == fchown(outfd, sbuf->st_uid, sbuf->st_gid)) {
@@ -900,8 +1144,97 @@ output_regf_uninit(int outfd, const struct stat *sbuf)
     failx(errno, "close(\"%s\")", opathn);
   }
 
-  free(opathn);
-  opathn = 0;
+  opathn_set(pathn, 0);
+  free((char *)opathn);
+}
+
+
+/*
+  Called after "operand" was processed successfully: if output went to a
+  regular file, restore its metadata from "*sbuf" and close it, then remove
+  the input file unless -k was given.
+*/
+void
+output_uninit(const struct filespec *os, char **pathn,
+              const struct arg *operand, const struct stat *sbuf)
+{
+  if (OM_REGF == outmode) {
+    output_regf_uninit(os->fd, pathn, sbuf);
+    if (!keep) {
+      input_oprnd_rm(operand);
+    }
+  }
+}
+
+
+/* Display data compression ratio and space savings. */
+void
+report_ratio(const struct filespec *is, const struct filespec *os)
+{
+  uintmax_t plain_size, compr_size;
+  double ratio, savings, ratio_magnitude;
+
+  /* Do the math. Note that converting from uintmax_t to double *may* result
+     in precision loss, but that shouldn't matter. */
+  plain_size = !decompress ? is->total : os->total;
+  compr_size = is->total ^ os->total ^ plain_size;
+  ratio = (double)compr_size / plain_size;
+  savings = 1 - ratio;
+  ratio_magnitude = ratio < 1 ? 1 / ratio : ratio;
+
+  infof(is, "compression ratio is %s%.3f%s, space savings is %.2f%%",
+        ratio < 1 ? "1:" : "", ratio_magnitude, ratio < 1 ? "" : ":1",
+        100 * savings);
+}
+
+
+/* The library engine used for --parallel-files reports neither timelines,
+   condition variable statistics, per-stage statistics nor progress.  Return
+   the first option given that needs them, or NULL if there is none. */
+static const char *
+engine_unsupported(void)
+{
+  if (0 != trace_pathn) {
+    return "--trace";
+  }
+  if (print_cctrs) {
+    return "-S";
+  }
+  if (stats_json) {
+    return "--stats=json";
+  }
+  if (verbose && isatty(STDERR_FILENO)) {
+    return "-v";
+  }
+  return 0;
+}
+
+
+/* Process a single operand, or stdin if "operand" is NULL. */
+static void
+work_operand(const struct arg *operand)
+{
+  struct stat instat;
+  struct timespec start;
+
+  if (-1 != input_init(&ispec, operand, &instat)) {
+    cli();
+    if (-1 != output_init(&ospec, opathn, operand, &instat)) {
+      start = stats_file_begin();
+      work();
+      stats_file_end(start, &ispec, &ospec);
+
+      output_uninit(&ospec, opathn, operand, &instat);
+
+      /* Display data compression ratio and space savings, but only if the
+         user desires so. */
+      if (verbose && 0u < ispec.total && 0u < ospec.total) {
+        report_ratio(&ispec, &ospec);
+      }
+    }                           /* output available or discarding */
+    sti();
+    input_uninit(&ispec);
+  }                             /* input available */
 }
 
 
@@ -909,6 +1242,8 @@ int
 main(int argc, char **argv)
 {
   struct arg *operands;
+  const char *serial_opt;
+  bool parallel;
   static char stderr_buf[BUFSIZ];
 
   pname = strrchr(argv[0], '/');
@@ -922,66 +1257,60 @@ main(int argc, char **argv)
   */
   small = 0;
 
-  do {
-    /* Process operand. */
-    {
-      int ret;
-      struct stat instat;
-
-      ret = input_init(operands, &instat);
-      if (-1 != ret) {
-        cli();
-        if (-1 != output_init(operands, &instat)) {
-          work();
-
-          if (OM_REGF == outmode) {
-            output_regf_uninit(ospec.fd, &instat);
-            if (!keep) {
-              input_oprnd_rm(operands);
-            }
-          }
+  stats_run_begin();
+  if (0 != trace_pathn) {
+    timeline_open(trace_pathn);
+  }
 
-          /* Display data compression ratio and space savings, but only if the
-             user desires so. */
-          if (verbose && 0u < ispec.total && 0u < ospec.total) {
-            uintmax_t plain_size, compr_size;
-            double ratio, savings, ratio_magnitude;
-
-            /* Do the math. Note that converting from uintmax_t to double *may*
-              result in precision loss, but that shouldn't matter. */
-            plain_size = !decompress ? ispec.total : ospec.total;
-            compr_size = ispec.total ^ ospec.total ^ plain_size;
-            ratio = (double)compr_size / plain_size;
-            savings = 1 - ratio;
-            ratio_magnitude = ratio < 1 ? 1 / ratio : ratio;
-
-            infof(&ispec,
-                  "compression ratio is %s%.3f%s, space savings is "
-                  "%.2f%%", ratio < 1 ? "1:" : "", ratio_magnitude,
-                  ratio < 1 ? "" : ":1", 100 * savings);
-          }
-        }                       /* output available or discarding */
-        sti();
-        input_uninit();
-      }                         /* input available */
+  if (recursive && 0 != operands) {
+    operands = walk_operands(operands);
+    if (0 == operands) {
+      /* Only empty directories were given; don't work as a filter. */
+      stats_run_end();
+      timeline_close();
+      gcov_flush();
+      _exit(warned ? EX_WARN : EX_OK);
     }
+  }
+
+  /* Several FILE operands can be processed at the same time, unless their
+     output has to be concatenated on stdout, or an option not supported by
+     the library engine was given. Recursive mode implies this. Options that
+     the library engine doesn't report on are not ignored silently. */
+  parallel = ((parallel_files || recursive) && OM_STDOUT != outmode
+              && 0 != operands && 0 != operands->next && !dedup
+              && 0u == blocks_per_stream);
+  if (parallel && 0 != (serial_opt = engine_unsupported())) {
+    info("processing files one at a time because %s was given", serial_opt);
+    parallel = 0;
+  }
 
-    /* Move to next operand. */
-    if (0 != operands) {
+  if (parallel) {
+    work_files(operands);
+  }
+  else {
+    do {
       struct arg *next;
 
-      next = operands->next;
-      free(operands);
-      operands = next;
+      work_operand(operands);
+
+      /* Move to next operand. */
+      if (0 != operands) {
+        next = operands->next;
+        free(operands);
+        operands = next;
+      }
     }
+    while (0 != operands);
   }
-  while (0 != operands);
 
-  assert(0 == opathn);
+  assert(0 == opathn_single);
   if (OM_STDOUT == outmode && -1 == close(STDOUT_FILENO)) {
     failx(errno, "close(stdout)");
   }
 
+  stats_run_end();
+  timeline_close();
   gcov_flush();
   _exit(warned ? EX_WARN : EX_OK);
 }
@@ -43,6 +43,12 @@ struct filespec {
   uintmax_t size;               /* file size or 0 if unknown */
 };
 
+/* An element of the list of FILE operands. */
+struct arg {
+  struct arg *next;
+  const char *val;
+};
+
 
 extern unsigned num_worker;     /* -n */
 extern size_t max_mem;          /* -m */
@@ -54,6 +60,10 @@ extern bool verbose;            /* -v */
 extern bool print_cctrs;        /* -S */
 extern bool small;              /* -s */
 extern bool ultra;              /* -u */
+extern bool dedup;              /* --dedup */
+extern unsigned blocks_per_stream; /* --stream-blocks */
+extern bool parallel_files;     /* --parallel-files */
+extern bool stats_json;         /* --stats=json */
 extern struct filespec ispec;
 extern struct filespec ospec;
 
@@ -89,4 +99,23 @@ _Noreturn void failfx(const struct filespec *f, int x, const char *fmt, ...)
 void display(const char *fmt, ...)
   format_printf(1, 2);
 
+struct stat;
+int input_init(struct filespec *is, const struct arg *operand,
+               struct stat *sbuf);
+void input_uninit(const struct filespec *is);
+int output_init(struct filespec *os, char **pathn, const struct arg *operand,
+                const struct stat *sbuf);
+void output_uninit(const struct filespec *os, char **pathn,
+                   const struct arg *operand, const struct stat *sbuf);
+void report_ratio(const struct filespec *is, const struct filespec *os);
+
+/* Read from 0 to `*vacant' bytes from given file, stopping early only at end
+   of file, and update `*vacant' to the number of unused bytes in the buffer.
+   Write the whole buffer to given file, unless its descriptor is -1.  Both
+   count the bytes in the file's total and handle I/O errors internally. */
+void fs_read(struct filespec *fs, void *vbuf, size_t *vacant);
+void fs_write(struct filespec *fs, const void *vbuf, size_t size);
+char **opathn_slots(unsigned n);
+
 void work(void);
+void work_files(struct arg *operands);
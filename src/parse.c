@@ -66,6 +66,15 @@
   the worst that can happen is complete waste of resources used by the n-1
   helper threads -- the deterministic sequential decompressor will still be
   able to complete the decompression job, without any help from other workers.)
+
+  Concatenated streams, as written by pbzip2 or by concatenating bzip2 files,
+  need no special treatment.  The scanner looks for block magic only, which
+  starts every block regardless of the stream it belongs to, so blocks of all
+  streams are retrieved concurrently.  The parser is left to walk stream
+  headers and trailers in order and to verify combined CRC of each stream,
+  which is computed from block CRCs stored in headers, not from decompressed
+  data.  This is cheap compared to retrieving blocks, so running independent
+  parsers for different streams wouldn't gain anything.
 */
 
 
@@ -271,11 +280,139 @@ parse(struct parser_state *restrict ps, struct header *restrict hd,
 }
 
 
+/* Take next "n" bits, where 0 < n <= 32, from bitstream "bs" into "v".
+   Return false if there are not enough bits available. */
+static bool
+bits_take(struct bitstream *bs, unsigned n, unsigned *v)
+{
+  if (bits_need(bs, n) != OK)
+    return false;
+
+  *v = bits_peek(bs, n);
+  bits_dump(bs, n);
+  return true;
+}
+
+
+/* Check whether block header starting at given position, which follows block
+   magic and CRC, looks valid.  The bitmap, number of trees and selectors,
+   selectors and code length deltas are checked as retrieve() checks them
+   before decoding any data.  This costs much less than retrieving the block,
+   so most false matches found by the scanner in random-looking data are
+   rejected early.
+
+   Prefix codes are also required to be complete, which is stricter than
+   retrieve(): it accepts incomplete and oversubscribed codes unless a group
+   is decoded with them (see decode.c).  No known encoder produces such codes.
+   A real block rejected here is not lost, as the parser finds every block on
+   its own; it is only not retrieved speculatively.
+
+   If the header extends beyond available input, there is not enough
+   information to tell, and true is returned.
+*/
+static bool
+plausible(struct bitstream bs)
+{
+  unsigned v, big, small, alpha_size, num_trees, num_selectors;
+  unsigned i, j, t, len;
+  uint32_t kraft;
+
+  /* Randomization bit and BWT primary index. */
+  if (!bits_take(&bs, 25u, &v))
+    return true;
+  if ((v & 0xFFFFFFu) >= MAX_BLOCK_SIZE)
+    return false;
+
+  /* Bitmap of symbols in use. */
+  if (!bits_take(&bs, 16u, &big))
+    return true;
+  if (big == 0u)
+    return false;
+  alpha_size = 0u;
+  for (i = 0u; i < 16u; ++i) {
+    if (big & (0x8000u >> i)) {
+      if (!bits_take(&bs, 16u, &small))
+        return true;
+      if (small == 0u)
+        return false;
+      for (; small != 0u; small &= small - 1u)
+        alpha_size++;
+    }
+  }
+  alpha_size += 2u;
+
+  if (!bits_take(&bs, 3u, &num_trees))
+    return true;
+  if (num_trees < MIN_TREES || num_trees > MAX_TREES)
+    return false;
+
+  if (!bits_take(&bs, 15u, &num_selectors))
+    return true;
+  if (num_selectors == 0u)
+    return false;
+
+  /* Selector MTF values, in unary code. */
+  for (j = 0u; j < num_selectors; ++j) {
+    for (i = 0u; ; ++i) {
+      if (!bits_take(&bs, 1u, &v))
+        return true;
+      if (v == 0u)
+        break;
+      if (i + 1u >= num_trees)
+        return false;
+    }
+  }
+
+  /* Delta-coded code lengths.  Each prefix code must be complete, unlike in
+     retrieve(). */
+  for (t = 0u; t < num_trees; ++t) {
+    if (!bits_take(&bs, 5u, &len))
+      return true;
+    kraft = 0u;
+    for (j = 0u; j < alpha_size; ++j) {
+      for (;;) {
+        if (len < MIN_CODE_LENGTH || len > MAX_CODE_LENGTH)
+          return false;
+        if (!bits_take(&bs, 1u, &v))
+          return true;
+        if (v == 0u)
+          break;
+        if (!bits_take(&bs, 1u, &v))
+          return true;
+        len += v ? -1 : 1;
+      }
+      kraft += 1u << (MAX_CODE_LENGTH - len);
+    }
+    if (kraft != 1u << MAX_CODE_LENGTH)
+      return false;
+  }
+
+  return true;
+}
+
+
+/* Return the state of the scanner DFA after the last 47 bits of block
+   magic, that is the state it would be in had it started scanning one bit
+   after the start of a match. */
+static unsigned
+resume_state(void)
+{
+  const uint64_t magic = 0x314159265359u;
+  unsigned state = 0u;
+  unsigned i;
+
+  for (i = 47u; i-- > 0u; )
+    state = mini_dfa[state][(magic >> i) & 1u];
+
+  return state;
+}
+
+
 /* Scan for magic bit sequence which presence indicates probable start of
    compressed block.
 
    Possible return codes:
-     OK   - the magic sequence was found
+     OK   - the magic sequence followed by a plausible block header was found
      MORE - block header magic was not found
 */
 int
@@ -283,6 +420,7 @@ scan(struct bitstream *bs, unsigned skip)
 {
   unsigned state = 0;
   const uint32_t *data, *limit;
+  struct bitstream hdr;
 
   if (skip > bs->live) {
     skip -= bs->live;
@@ -304,8 +442,18 @@ again:
 
     if (state == ACCEPT) {
       if (bits_need(bs, 32) == OK) {
-        bits_dump(bs, 32);
-        return OK;
+        hdr = *bs;
+        bits_dump(&hdr, 32);
+        if (plausible(hdr)) {
+          *bs = hdr;
+          return OK;
+        }
+        /* A false match.  A real header can start anywhere after its first
+           bit, even within its magic or CRC, so resume scanning there.  The
+           CRC bits are still unread, and the magic bits that follow the
+           first one are accounted for by the DFA state. */
+        state = resume_state();
+        continue;
       }
       else {
         bits_consume(bs);
@@ -22,15 +22,19 @@
 #include "common.h"
 
 #include <arpa/inet.h>          /* ntohl() */
+#include <fcntl.h>              /* fcntl() */
 #include <pthread.h>            /* pthread_t */
 #include <signal.h>             /* SIGUSR2 */
-#include <unistd.h>             /* write() */
+#include <sys/stat.h>           /* fstat() */
+#include <unistd.h>             /* pread() */
 
 #include "timespec.h"           /* struct timespec */
 #include "main.h"               /* work() */
 
 #include "process.h"            /* struct process */
 #include "signals.h"            /* halt() */
+#include "stats.h"              /* stats_stall() */
+#include "timeline.h"           /* timeline_begin() */
 
 
 /*
@@ -69,42 +73,140 @@
    In this case aborting seems wiser than printing error message and exiting
    because abort() can produce code dumps that can be useful in debugging.
 */
-#define xjoin(t)      ((void)(pthread_join((t), NULL)    && (abort(), 0)))
 #define xlock(m)      ((void)(pthread_mutex_lock(m)      && (abort(), 0)))
 #define xunlock(m)    ((void)(pthread_mutex_unlock(m)    && (abort(), 0)))
 #define xwait(c,m)    ((void)(pthread_cond_wait((c),(m)) && (abort(), 0)))
 #define xsignal(c)    ((void)(pthread_cond_signal(c)     && (abort(), 0)))
 #define xbroadcast(c) ((void)(pthread_cond_broadcast(c)  && (abort(), 0)))
 
+/* Like xwait(), but give up at given absolute time.  Return true on timeout.
+*/
+static bool
+xwait_until(pthread_cond_t *cond, pthread_mutex_t *mutex,
+            struct timespec deadline)
+{
+  int err;
+
+  err = pthread_cond_timedwait(cond, mutex, &deadline);
+  if (err == ETIMEDOUT)
+    return true;
+  if (err != 0)
+    abort();
+  return false;
+}
+
 struct thread_entry {
   void (*entry_func)(void);
 };
 
+
+/*
+  THREAD CREWS
+
+  Threads are not created for every file. A crew is a set of threads running
+  the same entry function, which stay around between files, waiting for the
+  next run. Starting a run wakes the requested number of crew members,
+  creating new threads only if the crew is smaller than that. Waiting for a
+  run replaces joining the threads.
+
+  Threads are created while signals are blocked by cli(), and they inherit
+  the blocked signal mask for their whole lifetime, so signals are still
+  delivered to the main thread only.
+*/
+struct crew {
+  struct thread_entry *entry;
+  pthread_cond_t start_cond;    /* signaled when a run starts */
+  pthread_cond_t done_cond;     /* signaled when a run is finished */
+  unsigned size;                /* number of threads in the crew */
+  unsigned active;              /* number of threads taking part in the run */
+  unsigned running;             /* number of them still running */
+  unsigned generation;          /* number of runs started */
+};
+
+struct crew_member {
+  struct crew *crew;
+  unsigned index;
+  unsigned seen;                /* last run seen by this member */
+};
+
+static pthread_mutex_t crew_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define CREW(entry) \
+  { (entry), PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0 }
+
+
 static void *
-thread_entry(void *entry)
+crew_thread(void *arg)
 {
-  struct thread_entry *te = entry;
-  te->entry_func();
-  return NULL;
+  struct crew_member *member = arg;
+  struct crew *crew = member->crew;
+
+  xlock(&crew_mutex);
+
+  for (;;) {
+    while (member->seen == crew->generation)
+      xwait(&crew->start_cond, &crew_mutex);
+    member->seen = crew->generation;
+
+    if (member->index >= crew->active)
+      continue;
+
+    xunlock(&crew_mutex);
+    crew->entry->entry_func();
+    xlock(&crew_mutex);
+
+    if (--crew->running == 0)
+      xsignal(&crew->done_cond);
+  }
 }
 
-/* Create a POSIX thread with error checking. */
-static pthread_t
-xcreate(struct thread_entry *entry)
+
+/* Start a run of "n" members of a crew, creating threads as needed. */
+static void
+crew_start(struct crew *crew, unsigned n)
 {
-  int err;
+  struct crew_member *member;
   pthread_t thread;
+  int err;
 
-  err = pthread_create(&thread, NULL, thread_entry, entry);
-  if (err != 0)
-    failx(err, "unable to create a POSIX thread");
+  xlock(&crew_mutex);
+  assert(crew->running == 0);
+
+  crew->generation++;
+  crew->active = n;
+  crew->running = n;
+
+  while (crew->size < n) {
+    member = XMALLOC(struct crew_member);
+    member->crew = crew;
+    member->index = crew->size;
+    member->seen = crew->generation - 1;
 
-  return thread;
+    err = pthread_create(&thread, NULL, crew_thread, member);
+    if (err != 0)
+      failx(err, "unable to create a POSIX thread");
+    (void)pthread_detach(thread);
+    crew->size++;
+  }
+
+  xbroadcast(&crew->start_cond);
+  xunlock(&crew_mutex);
+}
+
+
+/* Wait until all members of a crew have finished the current run. */
+static void
+crew_wait(struct crew *crew)
+{
+  xlock(&crew_mutex);
+  while (crew->running > 0)
+    xwait(&crew->done_cond, &crew_mutex);
+  xunlock(&crew_mutex);
 }
 
 
 void
-xread(void *vbuf, size_t *vacant)
+fs_read(struct filespec *fs, void *vbuf, size_t *vacant)
 {
   char *buffer = vbuf;
 
@@ -113,7 +215,7 @@ xread(void *vbuf, size_t *vacant)
   do {
     ssize_t rd;
 
-    rd = read(ispec.fd, buffer, *vacant > (size_t)SSIZE_MAX ?
+    rd = read(fs->fd, buffer, *vacant > (size_t)SSIZE_MAX ?
               (size_t)SSIZE_MAX : *vacant);
 
     /* End of file. */
@@ -122,33 +224,33 @@ xread(void *vbuf, size_t *vacant)
 
     /* Read error. */
     if (-1 == rd) {
-      failfx(&ispec, errno, "read()");
+      failfx(fs, errno, "read()");
     }
 
     *vacant -= (size_t)rd;
     buffer += (size_t)rd;
-    ispec.total += (size_t)rd;
+    fs->total += (size_t)rd;
   }
   while (*vacant > 0);
 }
 
 void
-xwrite(const void *vbuf, size_t size)
+fs_write(struct filespec *fs, const void *vbuf, size_t size)
 {
   const char *buffer = vbuf;
 
-  ospec.total += size;
+  fs->total += size;
 
-  if (size > 0 && ospec.fd != -1) {
+  if (size > 0 && fs->fd != -1) {
     do {
       ssize_t wr;
 
-      wr = write(ospec.fd, buffer, size > (size_t)SSIZE_MAX ?
+      wr = write(fs->fd, buffer, size > (size_t)SSIZE_MAX ?
                  (size_t)SSIZE_MAX : size);
 
       /* Write error. */
       if (-1 == wr) {
-        failfx(&ospec, errno, "write()");
+        failfx(fs, errno, "write()");
       }
 
       size -= (size_t)wr;
@@ -158,6 +260,18 @@ xwrite(const void *vbuf, size_t size)
   }
 }
 
+void
+xread(void *vbuf, size_t *vacant)
+{
+  fs_read(&ispec, vbuf, vacant);
+}
+
+void
+xwrite(const void *vbuf, size_t size)
+{
+  fs_write(&ospec, vbuf, size);
+}
+
 
 /* Parent and left child indices. */
 #define parent(i) (((i)-1)/2)
@@ -238,9 +352,19 @@ size_t out_granul;
 
 static bool request_close;
 
-static pthread_t source_thread;
-static pthread_t sink_thread;
-static pthread_t *worker_thread;
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static unsigned num_readers;       /* number of source threads */
+static unsigned readers_running;   /* number of them still running */
+static unsigned reader_id;         /* number of them started */
+static uint64_t next_ordinal;      /* ordinal of the next block to read */
+static uint64_t next_delivery;     /* ordinal of the next block to pass on */
+static bool input_done;            /* true iff the last block was passed on */
+static off_t read_base;            /* file offset of block number 0 */
+static off_t read_end;             /* file offset past the last block read */
+
+static unsigned num_writers;       /* number of sink threads */
+static unsigned writer_id;         /* number of them started */
+static off_t write_end;            /* file offset past the last block taken */
 
 
 struct block {
@@ -257,22 +381,79 @@ unsigned thread_id;
 static const struct task *next_task;
 
 
+/* Like xread(), but read from given offset of the input file, without using
+   or changing its file position.  Thread-safe. */
+static void
+xpread(void *vbuf, size_t *vacant, off_t offset)
+{
+  char *buffer = vbuf;
+
+  assert(*vacant > 0);
+
+  do {
+    ssize_t rd;
+
+    rd = pread(ispec.fd, buffer, *vacant > (size_t)SSIZE_MAX ?
+               (size_t)SSIZE_MAX : *vacant, offset);
+
+    /* End of file. */
+    if (0 == rd)
+      break;
+
+    /* Read error. */
+    if (-1 == rd) {
+      failfx(&ispec, errno, "pread()");
+    }
+
+    *vacant -= (size_t)rd;
+    buffer += (size_t)rd;
+    offset += rd;
+  }
+  while (*vacant > 0);
+}
+
+
+/* Input is read by one or more source threads.  A single source thread reads
+   the input sequentially with read().  If the input is a regular file, there
+   may be several of them, each one reading whole I/O blocks with pread() at
+   offsets computed from their ordinal numbers, so that reads of consecutive
+   blocks proceed in parallel.  In either case blocks are passed to the
+   process one at a time in order of their ordinals, like they would be by a
+   single reader: a source thread waits for its turn after reading its block.
+   The turn can't be taken while holding source_mutex, because on_block()
+   acquires sched_mutex, which is held while calling source_release_buffer().
+
+   Every source thread takes an input slot before it starts reading, so the
+   thread whose turn it is never waits for a slot.  Blocks following the
+   last one, which is the first one read only partially, are discarded.
+*/
 static void
 source_thread_proc(void)
 {
+  unsigned id;
+  uint64_t ordinal;
+  bool last;
+
+  xlock(&source_mutex);
+  id = reader_id++;
+  xunlock(&source_mutex);
+
   Trace(("    source: spawned"));
+  timeline_thread(TIMELINE_SOURCE(id));
 
   for (;;) {
     void *buffer;
     size_t vacant, avail;
+    uint64_t t0;
 
     xlock(&source_mutex);
-    while (in_slots == 0 && !request_close) {
+    while (in_slots == 0 && !request_close && !input_done) {
       Trace(("    source: stalled"));
+      stats_stall(STALL_SOURCE);
       xwait(&source_cond, &source_mutex);
     }
 
-    if (request_close) {
+    if (request_close || input_done) {
       Trace(("    source: received premature close requtest"));
       xunlock(&source_mutex);
       break;
@@ -280,33 +461,74 @@ source_thread_proc(void)
 
     Trace(("    source: reading data (%u free slots)", in_slots));
     in_slots--;
+    ordinal = next_ordinal++;
     xunlock(&source_mutex);
 
     vacant = in_granul;
     avail = vacant;
     buffer = XNMALLOC(vacant, uint8_t);
-    xread(buffer, &vacant);
+    t0 = timeline_begin();
+    timeline_block(ordinal, 0u);
+    if (num_readers == 1u)
+      xread(buffer, &vacant);
+    else
+      xpread(buffer, &vacant, read_base + (off_t)(ordinal * in_granul));
+    timeline_end("read", t0);
     avail -= vacant;
 
+    xlock(&source_mutex);
+    while (ordinal != next_delivery && !request_close && !input_done)
+      xwait(&turn_cond, &source_mutex);
+    last = (request_close || input_done);
+    xunlock(&source_mutex);
+
+    if (last) {
+      source_release_buffer(buffer);
+      break;
+    }
+
     Trace(("    source: block of %u bytes read", (unsigned)avail));
 
+    if (num_readers > 1u) {
+      ispec.total += avail;
+      read_end = read_base + (off_t)(ordinal * in_granul + avail);
+    }
+
     if (avail == 0u)
       source_release_buffer(buffer);
     else
       process->on_block(buffer, avail);
 
-    if (vacant > 0u)
-      break;
+    xlock(&source_mutex);
+    next_delivery++;
+    if (vacant > 0u) {
+      input_done = true;
+      xbroadcast(&source_cond);
+    }
+    xbroadcast(&turn_cond);
+    xunlock(&source_mutex);
   }
 
-  sched_lock();
-  eof = 1;
-  sched_unlock();
+  xlock(&source_mutex);
+  last = (--readers_running == 0u);
+  xunlock(&source_mutex);
+
+  /* The last source thread to terminate leaves the file position where a
+     single reader would have left it, and signals end of input. */
+  if (last) {
+    if (num_readers > 1u)
+      (void)lseek(ispec.fd, read_end, SEEK_SET);
+
+    sched_lock();
+    eof = 1;
+    sched_unlock();
+  }
 
   Trace(("    source: terminating"));
 }
 
 static struct thread_entry source_thread_entry = { source_thread_proc };
+static struct crew source_crew = CREW(&source_thread_entry);
 
 
 void
@@ -326,8 +548,8 @@ source_close(void)
 {
   xlock(&source_mutex);
   request_close = true;
-  if (in_slots == 0)
-    xsignal(&source_cond);
+  xbroadcast(&source_cond);
+  xbroadcast(&turn_cond);
   xunlock(&source_mutex);
 }
 
@@ -343,72 +565,212 @@ sink_write_buffer(void *buffer, size_t size, size_t weight)
 
   xlock(&sink_mutex);
   push(output_q, block);
+  stats_depth(QUEUE_OUTPUT, size(output_q));
   xsignal(&sink_cond);
   xunlock(&sink_mutex);
 }
 
 
+/* Display a status line for input of unknown size: amounts of data
+   processed so far, current throughput, numbers of input and output slots
+   and work units in use, and CPU utilization of the worker threads. */
 static void
-sink_thread_proc(void)
+show_status(uintmax_t processed, uintmax_t written, double rate,
+            double cpu_share)
 {
-  bool progress_enabled;
-  uintmax_t processed;
-  struct timespec start_time;
-  struct timespec next_time;
-  struct block block;
-  static const double UPDATE_INTERVAL_NANO = 1000000000L;
+  unsigned in_used, out_used, units_used;
 
-  Trace(("      sink: spawned"));
+  xlock(&source_mutex);
+  in_used = total_in_slots - in_slots;
+  xunlock(&source_mutex);
+
+  xlock(&sched_mutex);
+  out_used = total_out_slots - out_slots;
+  units_used = num_worker - min(work_units, num_worker);
+  xunlock(&sched_mutex);
+
+  display("progress: %.1f/%.1f MB, %.1f MB/s, in %u/%u, out %u/%u, "
+          "busy %u/%u, CPU %.0f%%    \r", processed / 1e6, written / 1e6,
+          rate / 1e6, in_used, total_in_slots, out_used, total_out_slots,
+          units_used, num_worker, 100 * cpu_share);
+}
 
+
+/* Progress information, protected by sink_mutex. */
+static bool progress_enabled;
+static uintmax_t processed, last_processed;
+static uintmax_t written;
+static uint64_t last_cpu;
+static struct timespec start_time;
+static struct timespec last_time;
+static struct timespec next_time;
+
+
+static void
+init_progress(void)
+{
   /* Progress info is displayed only if all the following conditions are met:
      1) the user has specified -v or --verbose option
      2) stderr is connected to a terminal device
-     3) the input file is a regular file
-     4) the input file is nonempty
+     If the input file is a nonempty regular file, percentage of completion
+     and ETA are displayed.  Otherwise, as for pipes, the size of input is
+     unknown, so throughput and use of pipeline resources are displayed.
    */
-  progress_enabled = (verbose && ispec.size > 0 && isatty(STDERR_FILENO));
+  progress_enabled = (verbose && isatty(STDERR_FILENO));
   processed = 0u;
+  last_processed = 0u;
+  written = 0u;
+  last_cpu = cpu_nsec(CLOCK_PROCESS_CPUTIME_ID);
   start_time = ts_now();
+  last_time = start_time;
   next_time = start_time;
+}
+
+
+/* Account for a block of "size" bytes and given weight that was written, and
+   update the progress display if it is due.  Only one of the sink threads
+   updates the display at a time, and it does so without holding sink_mutex,
+   since show_status() acquires other locks.  Stalled sink threads call this
+   with zero size when the update is due, so that the display keeps going,
+   and shows falling rates, while no blocks are written. */
+static void
+update_progress(size_t size, size_t weight)
+{
+  struct timespec time_now, prev_time;
+  uintmax_t now_processed, prev_processed, now_written;
+  uint64_t cpu, prev_cpu;
+  double completed, elapsed;
+  static const double UPDATE_INTERVAL_NANO = 1000000000L;
+
+  time_now = ts_now();
+  cpu = ispec.size > 0 ? 0u : cpu_nsec(CLOCK_PROCESS_CPUTIME_ID);
+
+  xlock(&sink_mutex);
+  processed += weight;
+  written += size;
+  if (!ts_before(next_time, time_now)) {
+    xunlock(&sink_mutex);
+    return;
+  }
+  next_time = ts_add_nano(time_now, UPDATE_INTERVAL_NANO);
+  now_processed = processed;
+  now_written = written;
+  prev_processed = last_processed;
+  prev_time = last_time;
+  prev_cpu = last_cpu;
+  last_processed = processed;
+  last_time = time_now;
+  last_cpu = cpu;
+  xunlock(&sink_mutex);
+
+  if (ispec.size > 0) {
+    elapsed = ts_diff(time_now, start_time);
+    completed = (double)min(now_processed, ispec.size) / ispec.size;
+
+    if (elapsed < 5)
+      display("progress: %.2f%%\r", 100 * completed);
+    else
+      display("progress: %.2f%%, ETA: %.0f s    \r",
+              100 * completed, elapsed * (1 / completed - 1));
+  }
+  else {
+    elapsed = ts_diff(time_now, prev_time);
+    if (elapsed > 0) {
+      show_status(now_processed, now_written,
+                  (now_processed - prev_processed) / elapsed,
+                  (cpu - prev_cpu) / 1e9 / elapsed / num_worker);
+    }
+  }
+}
+
+
+/* Like xwrite(), but write at given offset of the output file, without using
+   or changing its file position.  Thread-safe. */
+static void
+xpwrite(const void *vbuf, size_t size, off_t offset)
+{
+  const char *buffer = vbuf;
+
+  while (size > 0) {
+    ssize_t wr;
+
+    wr = pwrite(ospec.fd, buffer, size > (size_t)SSIZE_MAX ?
+                (size_t)SSIZE_MAX : size, offset);
+
+    /* Write error. */
+    if (-1 == wr) {
+      failfx(&ospec, errno, "pwrite()");
+    }
+
+    size -= (size_t)wr;
+    buffer += (size_t)wr;
+    offset += wr;
+  }
+}
+
+
+/* Output is written by one or more sink threads.  A single sink thread writes
+   the output sequentially with write().  If the output is a regular file not
+   opened for appending, there may be several of them.  Each one takes the
+   next block from output_q, together with the range of the file where the
+   block belongs, which is known because blocks are taken in order, and writes
+   it with pwrite(), so that writes of consecutive blocks proceed in parallel
+   and their output slots are released as soon as each write completes.
+*/
+static void
+sink_thread_proc(void)
+{
+  struct block block;
+  unsigned id;
+  off_t offset;
+  uint64_t t0;
+
+  xlock(&sink_mutex);
+  id = writer_id++;
+  xunlock(&sink_mutex);
+
+  Trace(("      sink: spawned"));
+  timeline_thread(TIMELINE_SINK(id));
 
   for (;;) {
     xlock(&sink_mutex);
-    while (empty(output_q) && !finish) {
+    if (empty(output_q) && !finish) {
       Trace(("      sink: stalled"));
-      xwait(&sink_cond, &sink_mutex);
+      stats_stall(STALL_SINK);
+    }
+    while (empty(output_q) && !finish) {
+      if (!progress_enabled)
+        xwait(&sink_cond, &sink_mutex);
+      else if (xwait_until(&sink_cond, &sink_mutex, next_time)) {
+        xunlock(&sink_mutex);
+        update_progress(0u, 0u);
+        xlock(&sink_mutex);
+      }
     }
 
     if (empty(output_q))
       break;
 
     block = shift(output_q);
+    offset = write_end;
+    if (num_writers > 1u) {
+      write_end += (off_t)block.size;
+      ospec.total += block.size;
+    }
     xunlock(&sink_mutex);
 
     Trace(("      sink: writing data (%u bytes)", (unsigned)block.size));
-    xwrite(block.buffer, block.size);
+    t0 = timeline_begin();
+    if (num_writers == 1u)
+      xwrite(block.buffer, block.size);
+    else
+      xpwrite(block.buffer, block.size, offset);
+    timeline_end("write", t0);
     Trace(("      sink: releasing output slot"));
     process->on_written(block.buffer);
 
-    if (progress_enabled) {
-      struct timespec time_now;
-      double completed, elapsed;
-
-      processed = min(processed + block.weight, ispec.size);
-
-      time_now = ts_now();
-
-      if (ts_before(next_time, time_now)) {
-        next_time = ts_add_nano(time_now, UPDATE_INTERVAL_NANO);
-        elapsed = ts_diff(time_now, start_time);
-        completed = (double)processed / ispec.size;
-
-        if (elapsed < 5)
-          display("progress: %.2f%%\r", 100 * completed);
-        else
-          display("progress: %.2f%%, ETA: %.0f s    \r",
-                  100 * completed, elapsed * (1 / completed - 1));
-      }
-    }
+    if (progress_enabled)
+      update_progress(block.size, block.weight);
   }
 
   xunlock(&sink_mutex);
@@ -416,7 +778,8 @@ sink_thread_proc(void)
   Trace(("      sink: terminating"));
 }
 
-struct thread_entry sink_thread_entry = { sink_thread_proc };
+static struct thread_entry sink_thread_entry = { sink_thread_proc };
+static struct crew sink_crew = CREW(&sink_thread_entry);
 
 
 static void
@@ -438,13 +801,22 @@ select_task(void)
 static void
 worker_thread_proc(void)
 {
+  const struct task *task;
+  unsigned id;
+  uint64_t t0;
+
   xlock(&sched_mutex);
-  Trace(("worker[%2u]: spawned", (id = thread_id++)));
+  id = thread_id++;
+  Trace(("worker[%2u]: spawned", id));
+  timeline_thread(id);
 
   for (;;) {
     while (next_task != NULL) {
       Trace(("worker[%2u]: scheduling task '%s'...", id, next_task->name));
-      next_task->run();
+      task = next_task;
+      t0 = timeline_begin();
+      task->run();
+      timeline_end(task->name, t0);
       select_task();
     }
 
@@ -452,6 +824,7 @@ worker_thread_proc(void)
       break;
 
     Trace(("worker[%2u]: stalled", id));
+    stats_stall(id);
     xwait(&sched_cond, &sched_mutex);
   }
 
@@ -462,6 +835,7 @@ worker_thread_proc(void)
 }
 
 static struct thread_entry worker_thread_entry = { worker_thread_proc };
+static struct crew worker_crew = CREW(&worker_thread_entry);
 
 
 /* Enter scheduler monitor. */
@@ -492,22 +866,38 @@ init_io(void)
   finish = false;
   deque_init(output_q, out_slots);
 
-  sink_thread = xcreate(&sink_thread_entry);
-  source_thread = xcreate(&source_thread_entry);
+  readers_running = num_readers;
+  reader_id = 0u;
+  next_ordinal = 0u;
+  next_delivery = 0u;
+  input_done = false;
+  writer_id = 0u;
+  init_progress();
+
+  /* The process may have written some output in its init(). */
+  if (num_writers > 1u)
+    write_end = lseek(ospec.fd, 0, SEEK_CUR);
+
+  crew_start(&sink_crew, num_writers);
+  crew_start(&source_crew, num_readers);
 }
 
 
 static void
 uninit_io(void)
 {
-  xjoin(source_thread);
+  crew_wait(&source_crew);
 
   xlock(&sink_mutex);
   finish = true;
-  xsignal(&sink_cond);
+  xbroadcast(&sink_cond);
   xunlock(&sink_mutex);
 
-  xjoin(sink_thread);
+  crew_wait(&sink_crew);
+
+  /* Leave the file position where a single sink thread would have left it. */
+  if (num_writers > 1u)
+    (void)lseek(ospec.fd, write_end, SEEK_SET);
   deque_uninit(output_q);
 }
 
@@ -515,8 +905,6 @@ uninit_io(void)
 static void
 primary_thread(void)
 {
-  unsigned i;
-
   thread_id = 0;
 
   eof = false;
@@ -528,13 +916,10 @@ primary_thread(void)
   select_task();
   init_io();
 
-  for (i = 1u; i < num_worker; ++i)
-    worker_thread[i] = xcreate(&worker_thread_entry);
-
+  /* The primary thread is worker number 0. */
+  crew_start(&worker_crew, num_worker - 1u);
   worker_thread_proc();
-
-  for (i = 1u; i < num_worker; ++i)
-    xjoin(worker_thread[i]);
+  crew_wait(&worker_crew);
 
   uninit_io();
   process->uninit();
@@ -548,6 +933,7 @@ primary_thread(void)
 }
 
 static struct thread_entry primary_thread_entry = { primary_thread };
+static struct crew primary_crew = CREW(&primary_thread_entry);
 
 
 static void
@@ -600,6 +986,8 @@ copy(void)
   out_slots = 2;
   total_out_slots = 2;
   in_granul = 65536;
+  num_readers = 1u;
+  num_writers = 1u;
 
   process = &pseudo_process;
   init_io();
@@ -608,16 +996,43 @@ copy(void)
 }
 
 
+/* Use one source thread per worker if the input is a regular file, which can
+   be read at arbitrary offsets, or a single one otherwise.  Likewise for sink
+   threads and the output, unless it is in append mode, in which case writes
+   always go to the end of file. */
+static void
+set_num_threads(void)
+{
+  struct stat st;
+  int flags;
+
+  num_readers = 1u;
+  num_writers = 1u;
+
+  if (num_worker > 1u && fstat(ispec.fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    read_base = lseek(ispec.fd, 0, SEEK_CUR);
+    if (read_base != -1) {
+      read_end = read_base;
+      num_readers = min(num_worker, total_in_slots);
+    }
+  }
+
+  if (num_worker > 1u && ospec.fd != -1 && fstat(ospec.fd, &st) == 0
+      && S_ISREG(st.st_mode) && (flags = fcntl(ospec.fd, F_GETFL)) != -1
+      && !(flags & O_APPEND) && lseek(ospec.fd, 0, SEEK_CUR) != -1)
+    num_writers = min(num_worker, total_out_slots);
+}
+
+
 static void
 schedule(const struct process *proc)
 {
   process = proc;
+  set_num_threads();
 
-  worker_thread = XNMALLOC(num_worker, pthread_t);
-  *worker_thread = xcreate(&primary_thread_entry);
+  crew_start(&primary_crew, 1);
   halt();
-  xjoin(*worker_thread);
-  free(worker_thread);
+  crew_wait(&primary_crew);
 }
 
 
@@ -0,0 +1,29 @@
+/*-
+  sha256.h -- SHA-256 message digest
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>             /* size_t */
+#include <stdint.h>             /* uint8_t */
+
+#define SHA256_SIZE 32
+
+/* Compute SHA-256 digest of "size" bytes at "data" and store it in
+   "digest". */
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE]);
@@ -0,0 +1,297 @@
+/*-
+  stats.c -- run-time statistics
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+#include <pthread.h>            /* pthread_mutex_lock() */
+#include <stdio.h>              /* fprintf() */
+#include <string.h>             /* memset() */
+
+#include "timespec.h"           /* cpu_nsec() */
+#include "main.h"               /* stats_json */
+#include "signals.h"            /* bailout() */
+#include "stats.h"
+
+
+/*
+  With --stats=json a JSON object is written to stderr on a line of its own
+  after each file, and one more at the end of the run, summing up all files.
+
+  Stage CPU times are measured with the thread CPU-time clock around the
+  kernel calls made by compress.c and expand.c, so they don't include time
+  spent waiting for locks. Queue depths and stalls are recorded under the
+  locks protecting the respective queues and condition variables, so they
+  need no further synchronization; only the stage counters, which are
+  updated by workers running concurrently, are protected by "stats_mutex".
+*/
+
+
+static const char *const stage_name[NUM_STAGES] = {
+  "collect", "encode", "transmit",
+  "scan", "parse", "retrieve", "decode", "emit",
+};
+
+static const char *const queue_name[NUM_QUEUES] = {
+  "collect", "transmit",
+  "input", "scan", "retrieve", "decode", "emit", "unordered",
+  "reorder", "output",
+};
+
+struct counters {
+  uintmax_t stage_calls[NUM_STAGES];
+  uint64_t stage_nsec[NUM_STAGES];
+  unsigned queue_max[NUM_QUEUES];
+  uintmax_t *worker_stalls;
+  uintmax_t source_stalls;
+  uintmax_t sink_stalls;
+};
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct counters file_ctr;        /* current file in process.c */
+static struct counters run_ctr;         /* all files */
+static struct timespec run_start;
+static uintmax_t run_files;
+static uintmax_t run_bytes_in;
+static uintmax_t run_bytes_out;
+
+
+uint64_t
+stage_begin(void)
+{
+  return stats_json ? cpu_nsec(CLOCK_THREAD_CPUTIME_ID) : 0u;
+}
+
+
+void
+stage_end(enum stage st, uint64_t start)
+{
+  uint64_t now;
+
+  if (!stats_json)
+    return;
+
+  now = cpu_nsec(CLOCK_THREAD_CPUTIME_ID);
+
+  (void)pthread_mutex_lock(&stats_mutex);
+  file_ctr.stage_calls[st]++;
+  file_ctr.stage_nsec[st] += now - min(now, start);
+  (void)pthread_mutex_unlock(&stats_mutex);
+}
+
+
+void
+stats_depth(enum queue q, unsigned depth)
+{
+  if (!stats_json)
+    return;
+
+  if (depth > file_ctr.queue_max[q])
+    file_ctr.queue_max[q] = depth;
+}
+
+
+void
+stats_stall(int thr)
+{
+  if (!stats_json)
+    return;
+
+  if (thr == STALL_SOURCE)
+    file_ctr.source_stalls++;
+  else if (thr == STALL_SINK)
+    file_ctr.sink_stalls++;
+  else if ((unsigned)thr < num_worker)
+    file_ctr.worker_stalls[thr]++;
+}
+
+
+static void
+reset(struct counters *ctr)
+{
+  uintmax_t *worker_stalls = ctr->worker_stalls;
+  unsigned i;
+
+  if (worker_stalls == NULL)
+    worker_stalls = XNMALLOC(num_worker, uintmax_t);
+  for (i = 0u; i < num_worker; ++i)
+    worker_stalls[i] = 0u;
+
+  memset(ctr, 0, sizeof(*ctr));
+  ctr->worker_stalls = worker_stalls;
+}
+
+
+void
+stats_run_begin(void)
+{
+  if (!stats_json)
+    return;
+
+  run_start = ts_now();
+  reset(&file_ctr);
+  reset(&run_ctr);
+}
+
+
+struct timespec
+stats_file_begin(void)
+{
+  if (stats_json) {
+    (void)pthread_mutex_lock(&stats_mutex);
+    reset(&file_ctr);
+    (void)pthread_mutex_unlock(&stats_mutex);
+  }
+
+  return ts_now();
+}
+
+
+/* Write string "s" as a JSON string literal.  File names needn't be valid
+   UTF-8, so bytes that aren't ASCII are escaped as code points U+0080 to
+   U+00FF, as if the string was in ISO 8859-1. */
+static void
+put_string(const char *s)
+{
+  putc_unlocked('"', stderr);
+  for (; *s != '\0'; ++s) {
+    unsigned char c = *s;
+
+    if (c == '"' || c == '\\')
+      fprintf(stderr, "\\%c", c);
+    else if (c < 0x20u || c >= 0x80u)
+      fprintf(stderr, "\\u%04x", c);
+    else
+      putc_unlocked(c, stderr);
+  }
+  putc_unlocked('"', stderr);
+}
+
+
+static void
+put_counters(const struct counters *ctr)
+{
+  unsigned first, last, i;
+
+  /* Only the stages and queues of the current operation. */
+  first = decompress ? STAGE_SCAN : STAGE_COLLECT;
+  last = decompress ? NUM_STAGES : STAGE_SCAN;
+
+  fprintf(stderr, ",\"blocks\":%ju,\"stages\":{",
+          ctr->stage_calls[decompress ? STAGE_DECODE : STAGE_TRANSMIT]);
+  for (i = first; i < last; ++i) {
+    fprintf(stderr, "%s\"%s\":{\"calls\":%ju,\"cpu_time\":%.6f}",
+            i == first ? "" : ",", stage_name[i], ctr->stage_calls[i],
+            ctr->stage_nsec[i] / 1e9);
+  }
+
+  first = decompress ? QUEUE_INPUT : QUEUE_COLLECT;
+  last = decompress ? QUEUE_REORDER : QUEUE_INPUT;
+
+  fprintf(stderr, "},\"queue_high_water\":{");
+  for (i = first; i < last; ++i) {
+    fprintf(stderr, "\"%s\":%u,", queue_name[i], ctr->queue_max[i]);
+  }
+  fprintf(stderr, "\"%s\":%u,\"%s\":%u}", queue_name[QUEUE_REORDER],
+          ctr->queue_max[QUEUE_REORDER], queue_name[QUEUE_OUTPUT],
+          ctr->queue_max[QUEUE_OUTPUT]);
+
+  fprintf(stderr, ",\"stalls\":{\"workers\":[");
+  for (i = 0u; i < num_worker; ++i) {
+    fprintf(stderr, "%s%ju", i == 0u ? "" : ",", ctr->worker_stalls[i]);
+  }
+  fprintf(stderr, "],\"source\":%ju,\"sink\":%ju}", ctr->source_stalls,
+          ctr->sink_stalls);
+}
+
+
+static void
+put_end(void)
+{
+  fprintf(stderr, "}\n");
+  if (ferror(stderr) || fflush(stderr) != 0)
+    bailout();
+}
+
+
+void
+stats_file_end(struct timespec start, const struct filespec *is,
+               const struct filespec *os)
+{
+  double wall;
+  unsigned i;
+
+  if (!stats_json)
+    return;
+
+  wall = ts_diff(ts_now(), start);
+
+  (void)pthread_mutex_lock(&stats_mutex);
+
+  run_files++;
+  run_bytes_in += is->total;
+  run_bytes_out += os->total;
+
+  for (i = 0u; i < NUM_STAGES; ++i) {
+    run_ctr.stage_calls[i] += file_ctr.stage_calls[i];
+    run_ctr.stage_nsec[i] += file_ctr.stage_nsec[i];
+  }
+  for (i = 0u; i < NUM_QUEUES; ++i) {
+    run_ctr.queue_max[i] = max(run_ctr.queue_max[i], file_ctr.queue_max[i]);
+  }
+  for (i = 0u; i < num_worker; ++i) {
+    run_ctr.worker_stalls[i] += file_ctr.worker_stalls[i];
+  }
+  run_ctr.source_stalls += file_ctr.source_stalls;
+  run_ctr.sink_stalls += file_ctr.sink_stalls;
+
+  flockfile(stderr);
+  fprintf(stderr, "{\"type\":\"file\",\"operation\":\"%s\",\"input\":",
+          decompress ? "decompress" : "compress");
+  put_string(is->fmt);
+  fprintf(stderr, ",\"output\":");
+  put_string(os->fmt);
+  fprintf(stderr, ",\"bytes_in\":%ju,\"bytes_out\":%ju,\"wall_time\":%.6f",
+          is->total, os->total, wall);
+  put_counters(&file_ctr);
+  put_end();
+  funlockfile(stderr);
+
+  (void)pthread_mutex_unlock(&stats_mutex);
+}
+
+
+void
+stats_run_end(void)
+{
+  if (!stats_json)
+    return;
+
+  flockfile(stderr);
+  fprintf(stderr, "{\"type\":\"run\",\"operation\":\"%s\",\"files\":%ju,"
+          "\"bytes_in\":%ju,\"bytes_out\":%ju,\"wall_time\":%.6f,"
+          "\"cpu_time\":%.6f,\"threads\":%u",
+          decompress ? "decompress" : "compress", run_files, run_bytes_in,
+          run_bytes_out, ts_diff(ts_now(), run_start),
+          cpu_nsec(CLOCK_PROCESS_CPUTIME_ID) / 1e9, num_worker);
+  put_counters(&run_ctr);
+  put_end();
+  funlockfile(stderr);
+}
@@ -0,0 +1,86 @@
+/*-
+  stats.h -- run-time statistics header
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>               /* struct timespec */
+
+
+/* Pipeline stages whose CPU time is measured. */
+enum stage {
+  STAGE_COLLECT,
+  STAGE_ENCODE,
+  STAGE_TRANSMIT,
+  STAGE_SCAN,
+  STAGE_PARSE,
+  STAGE_RETRIEVE,
+  STAGE_DECODE,
+  STAGE_EMIT,
+  NUM_STAGES
+};
+
+/* Queues whose depth high-water marks are recorded. */
+enum queue {
+  QUEUE_COLLECT,
+  QUEUE_TRANSMIT,
+  QUEUE_INPUT,
+  QUEUE_SCAN,
+  QUEUE_RETRIEVE,
+  QUEUE_DECODE,
+  QUEUE_EMIT,
+  QUEUE_UNORDERED,
+  QUEUE_REORDER,
+  QUEUE_OUTPUT,
+  NUM_QUEUES
+};
+
+/* Threads other than workers, which are identified by their number. */
+#define STALL_SOURCE (-1)
+#define STALL_SINK   (-2)
+
+
+/* Return the CPU time consumed so far by the calling thread, in nanoseconds,
+   or 0 if statistics are disabled. */
+uint64_t stage_begin(void);
+
+/* Account the CPU time elapsed since stage_begin() returned "start" to stage
+   "st".  Thread-safe. */
+void stage_end(enum stage st, uint64_t start);
+
+/* Record the current depth of queue "q".  Must be called with the lock
+   protecting the queue held. */
+void stats_depth(enum queue q, unsigned depth);
+
+/* Count a wait for work by worker "thr" or by the thread given by one of the
+   STALL_* constants.  Must be called with the lock the thread waits on held.
+*/
+void stats_stall(int thr);
+
+/* Start collecting statistics for the run. */
+void stats_run_begin(void);
+
+/* Start collecting statistics for a file and return its start time. */
+struct timespec stats_file_begin(void);
+
+/* Report statistics of a file. */
+void stats_file_end(struct timespec start, const struct filespec *is,
+                    const struct filespec *os);
+
+/* Report statistics of the whole run. */
+void stats_run_end(void);
@@ -0,0 +1,243 @@
+/*-
+  timeline.c -- scheduler timeline recording
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+#include <pthread.h>            /* pthread_setspecific() */
+#include <stdio.h>              /* fopen() */
+
+#include "timespec.h"           /* ts_now() */
+#include "main.h"               /* num_worker */
+#include "timeline.h"
+
+
+/*
+  With --trace=FILE every task run by a worker, every read by a source
+  thread and every write by a sink thread is recorded as an event with its
+  start and end time.  Events are stored in a ring buffer owned by the thread
+  that recorded them, so recording takes no locks; when a buffer fills up,
+  the oldest events are overwritten.  At the end of the run all buffers are
+  written to FILE in the Chrome trace event format, which can be viewed in
+  chrome://tracing or Perfetto.
+
+  Buffers are written only after all threads are done with them, so no
+  synchronization beyond that of thread start and termination is needed.
+*/
+
+
+/* Number of events kept by each thread. */
+#define RING_SIZE (1u << 16)
+
+/* Position of events not tagged with timeline_block(). */
+#define NO_BLOCK UINT64_MAX
+
+
+struct event {
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+  uint64_t major;
+  uint64_t minor;
+};
+
+struct ring {
+  struct event *events;         /* allocated on first use */
+  uint64_t count;               /* number of events ever recorded */
+  uint64_t major;               /* tag of the current event */
+  uint64_t minor;
+};
+
+static FILE *file;
+static const char *file_pathn;
+static struct timespec origin;
+static unsigned num_rings;
+static struct ring *rings;
+static pthread_key_t ring_key;
+
+
+void
+timeline_open(const char *pathn)
+{
+  unsigned i;
+  int err;
+
+  file = fopen(pathn, "w");
+  if (file == NULL)
+    failx(errno, "fopen(\"%s\")", pathn);
+  file_pathn = pathn;
+
+  err = pthread_key_create(&ring_key, NULL);
+  if (err != 0)
+    failx(err, "pthread_key_create()");
+
+  /* Workers come first, then source and sink threads, interleaved.  There
+     are at most as many threads of each kind as there are workers. */
+  num_rings = 3u * num_worker;
+  rings = XNMALLOC(num_rings, struct ring);
+  for (i = 0u; i < num_rings; ++i) {
+    rings[i].events = NULL;
+    rings[i].count = 0u;
+  }
+
+  origin = ts_now();
+}
+
+
+void
+timeline_thread(int thr)
+{
+  struct ring *ring;
+  int err;
+
+  if (file == NULL)
+    return;
+
+  if (thr >= 0)
+    ring = &rings[thr];
+  else
+    ring = &rings[num_worker + (unsigned)(TIMELINE_SOURCE(0) - thr)];
+
+  if (ring->events == NULL)
+    ring->events = XNMALLOC(RING_SIZE, struct event);
+
+  err = pthread_setspecific(ring_key, ring);
+  if (err != 0)
+    failx(err, "pthread_setspecific()");
+}
+
+
+static uint64_t
+now_nsec(void)
+{
+  struct timespec ts = ts_now();
+
+  return ((uint64_t)(ts.tv_sec - origin.tv_sec) * 1000000000u
+          + ts.tv_nsec - origin.tv_nsec);
+}
+
+
+uint64_t
+timeline_begin(void)
+{
+  struct ring *ring;
+
+  if (file == NULL)
+    return 0u;
+
+  ring = pthread_getspecific(ring_key);
+  ring->major = NO_BLOCK;
+  ring->minor = NO_BLOCK;
+
+  return now_nsec();
+}
+
+
+void
+timeline_end(const char *name, uint64_t start)
+{
+  struct ring *ring;
+  struct event *ev;
+
+  if (file == NULL)
+    return;
+
+  ring = pthread_getspecific(ring_key);
+  ev = &ring->events[ring->count++ % RING_SIZE];
+  ev->name = name;
+  ev->start = start;
+  ev->end = now_nsec();
+  ev->major = ring->major;
+  ev->minor = ring->minor;
+}
+
+
+void
+timeline_block(uint64_t major, uint64_t minor)
+{
+  struct ring *ring;
+
+  if (file == NULL)
+    return;
+
+  ring = pthread_getspecific(ring_key);
+  ring->major = major;
+  ring->minor = minor;
+}
+
+
+static void
+put_thread_name(unsigned tid, const char *name, unsigned num)
+{
+  fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+          "\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+          tid == 0u ? "" : ",\n", tid, name, num);
+}
+
+
+void
+timeline_close(void)
+{
+  const struct ring *ring;
+  const struct event *ev;
+  uint64_t first, i, dropped;
+  unsigned tid;
+
+  if (file == NULL)
+    return;
+
+  fprintf(file, "{\"traceEvents\":[\n");
+
+  for (tid = 0u; tid < num_worker; ++tid)
+    put_thread_name(tid, "worker", tid);
+  for (tid = 0u; tid < 2u * num_worker; ++tid)
+    put_thread_name(num_worker + tid, tid % 2u ? "sink" : "source", tid / 2u);
+
+  /* Timestamps are in microseconds. */
+  dropped = 0u;
+  for (tid = 0u; tid < num_rings; ++tid) {
+    ring = &rings[tid];
+    first = ring->count - min(ring->count, (uint64_t)RING_SIZE);
+    dropped += first;
+
+    for (i = first; i < ring->count; ++i) {
+      ev = &ring->events[i % RING_SIZE];
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+              "\"ts\":%.3f,\"dur\":%.3f", ev->name, tid, ev->start / 1e3,
+              (ev->end - ev->start) / 1e3);
+      if (ev->major != NO_BLOCK) {
+        fprintf(file, ",\"args\":{\"major\":%" PRIu64 ",\"minor\":%" PRIu64
+                "}", ev->major, ev->minor);
+      }
+      fprintf(file, "}");
+    }
+
+    free(ring->events);
+  }
+
+  fprintf(file, "\n],\"otherData\":{\"dropped_events\":%" PRIu64 "}}\n",
+          dropped);
+
+  if (ferror(file) | fclose(file))
+    failx(errno, "fclose(\"%s\")", file_pathn);
+
+  free(rings);
+  file = NULL;
+}
@@ -0,0 +1,49 @@
+/*-
+  timeline.h -- scheduler timeline recording header
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/* Threads other than workers, which are identified by their number: source
+   and sink thread number "k". */
+#define TIMELINE_SOURCE(k) (-1 - 2 * (int)(k))
+#define TIMELINE_SINK(k)   (-2 - 2 * (int)(k))
+
+
+/* Start recording to file "pathn".  Must be called after the number of worker
+   threads is known and before any thread is started. */
+void timeline_open(const char *pathn);
+
+/* Select the buffer the calling thread records to: that of worker "thr" or of
+   the thread given by one of the TIMELINE_* macros. */
+void timeline_thread(int thr);
+
+/* Return the time an event starts, or 0 if no timeline is being recorded. */
+uint64_t timeline_begin(void);
+
+/* Record an event "name" started at "start" and ending now, in the buffer of
+   the calling thread.  "name" must be a string constant. */
+void timeline_end(const char *name, uint64_t start);
+
+/* Tag the event the calling thread is in with the position of the block it
+   works on. */
+void timeline_block(uint64_t major, uint64_t minor);
+
+/* Write all recorded events to the timeline file and close it. */
+void timeline_close(void);
@@ -60,3 +60,16 @@ ts_diff(struct timespec a, struct timespec b)
   }
   return ts.tv_sec + ts.tv_nsec / 1e9;
 }
+
+/* Return the CPU time measured by given clock, in nanoseconds, or 0 if the
+   clock is not available. */
+uint64_t
+cpu_nsec(clockid_t clock)
+{
+  struct timespec ts;
+
+  if (clock_gettime(clock, &ts) != 0)
+    return 0u;
+
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
@@ -21,8 +21,10 @@
 
 #include <time.h>
 #include <stdbool.h>            /* bool */
+#include <stdint.h>             /* uint64_t */
 
 struct timespec ts_now(void);
 bool ts_before(struct timespec a, struct timespec b);
 struct timespec ts_add_nano(struct timespec a, long nano);
 double ts_diff(struct timespec a, struct timespec b);
+uint64_t cpu_nsec(clockid_t clock);
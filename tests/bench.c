@@ -0,0 +1,359 @@
+/*-
+  bench.c -- throughput benchmark driver
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Usage: bench [-s MIB] [-t THREADS,...] [-r REPEAT] [-o CSV]
+
+  Generate reproducible corpora of several kinds in directory "bench-corpus"
+  (or reuse them if they already exist with the right size), compress and
+  decompress each of them with "./lbzip2 --stats=json" using each given
+  number of worker threads, and write results as CSV to standard output,
+  or to file CSV.
+
+  For every corpus, thread count and operation there is one "total" row
+  with wall time of the whole run, and one row per pipeline stage with the
+  CPU time spent in that stage summed over all threads, as reported by
+  --stats=json.  Throughput is always given in megabytes (10^6 bytes) of
+  uncompressed data per second, so rows can be compared with each other.
+  Each measurement is repeated REPEAT times and the fastest run is kept.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+
+
+static const char *program = "./lbzip2";
+static const char *corpus_dir = "bench-corpus";
+
+/* Stages reported by --stats=json, in order of appearance. */
+static const char *const compress_stages[] = {
+  "collect", "encode", "transmit", NULL,
+};
+static const char *const expand_stages[] = {
+  "scan", "parse", "retrieve", "decode", "emit", NULL,
+};
+
+
+/* Print message to stderr and exit. */
+static void
+b_error(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "bench: ");
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fprintf(stderr, "\n");
+
+  exit(2);
+}
+
+
+/* Write corpus "c" of given size unless it already exists. */
+static void
+make_corpus(const struct corpus *c, size_t size, const char *path)
+{
+  struct stat st;
+  uint8_t *buf;
+  FILE *f;
+
+  if (stat(path, &st) == 0 && (size_t)st.st_size == size)
+    return;
+
+  buf = malloc(size);
+  if (buf == NULL)
+    b_error("out of memory");
+  rng_seed(size ^ (uintptr_t)c->name[0] << 32);
+  c->generate(buf, size);
+
+  f = fopen(path, "wb");
+  if (f == NULL || fwrite(buf, 1, size, f) != size || fclose(f) != 0)
+    b_error("unable to write %s: %s", path, strerror(errno));
+  free(buf);
+}
+
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Run lbzip2 with standard streams connected to given files and return its
+   wall time.  Exit if it fails. */
+static double
+run(char *const argv[], const char *in, const char *out, const char *err)
+{
+  int fd[3];
+  pid_t pid;
+  int status;
+  double start;
+
+  fd[0] = open(in, O_RDONLY);
+  fd[1] = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  fd[2] = open(err, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd[0] == -1 || fd[1] == -1 || fd[2] == -1)
+    b_error("unable to open files for %s: %s", in, strerror(errno));
+
+  start = now();
+  pid = fork();
+  if (pid == -1)
+    b_error("fork: %s", strerror(errno));
+  if (pid == 0) {
+    if (dup2(fd[0], 0) == -1 || dup2(fd[1], 1) == -1 || dup2(fd[2], 2) == -1)
+      _exit(66);
+    (void)execv(program, argv);
+    _exit(66);
+  }
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR)
+      b_error("waitpid: %s", strerror(errno));
+  }
+  start = now() - start;
+
+  close(fd[0]);
+  close(fd[1]);
+  close(fd[2]);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    b_error("%s failed on %s, see %s", program, in, err);
+
+  return start;
+}
+
+
+/* Read whole file into a newly allocated string. */
+static char *
+slurp(const char *path)
+{
+  FILE *f;
+  char *s;
+  size_t n;
+
+  f = fopen(path, "rb");
+  if (f == NULL)
+    b_error("unable to open %s: %s", path, strerror(errno));
+  s = malloc(65536u);
+  if (s == NULL)
+    b_error("out of memory");
+  n = fread(s, 1, 65535u, f);
+  s[n] = '\0';
+  fclose(f);
+
+  return s;
+}
+
+
+/* Return CPU time of stage "name" from the "run" object printed by
+   --stats=json, which is the last line of "stats". */
+static double
+stage_time(const char *stats, const char *name)
+{
+  const char *run, *p;
+  char key[64];
+
+  run = strstr(stats, "{\"type\":\"run\"");
+  if (run == NULL)
+    b_error("no run statistics");
+
+  snprintf(key, sizeof(key), "\"%s\":{\"calls\":", name);
+  p = strstr(run, key);
+  if (p == NULL || (p = strstr(p, "\"cpu_time\":")) == NULL)
+    b_error("no statistics for stage %s", name);
+
+  return strtod(p + 11, NULL);
+}
+
+
+/* Check that two files have the same contents. */
+static void
+compare(const char *a, const char *b)
+{
+  int fa, fb;
+  struct stat sa, sb;
+  void *pa, *pb;
+
+  fa = open(a, O_RDONLY);
+  fb = open(b, O_RDONLY);
+  if (fa == -1 || fb == -1 || fstat(fa, &sa) != 0 || fstat(fb, &sb) != 0)
+    b_error("unable to compare %s and %s", a, b);
+  if (sa.st_size != sb.st_size)
+    b_error("round trip of %s failed: sizes differ", a);
+  if (sa.st_size > 0) {
+    pa = mmap(NULL, sa.st_size, PROT_READ, MAP_SHARED, fa, 0);
+    pb = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fb, 0);
+    if (pa == MAP_FAILED || pb == MAP_FAILED)
+      b_error("mmap: %s", strerror(errno));
+    if (memcmp(pa, pb, sa.st_size) != 0)
+      b_error("round trip of %s failed: contents differ", a);
+    munmap(pa, sa.st_size);
+    munmap(pb, sb.st_size);
+  }
+  close(fa);
+  close(fb);
+}
+
+
+static void
+report(const char *corpus, size_t size, unsigned thr, const char *op,
+       const char *stage, double sec)
+{
+  printf("%s,%zu,%u,%s,%s,%.6f,%.2f\n", corpus, size, thr, op, stage, sec,
+         sec > 0 ? size / sec / 1e6 : 0.0);
+}
+
+
+/* Run one operation "repeat" times and report the fastest run. */
+static void
+measure(const char *corpus, size_t size, unsigned thr, unsigned repeat,
+        bool decompress, const char *in, const char *out)
+{
+  const char *const *stages = decompress ? expand_stages : compress_stages;
+  const char *op = decompress ? "decompress" : "compress";
+  char threads[16];
+  char err[256];
+  char *argv[7];
+  char *stats = NULL, *s;
+  double best = -1, t;
+  unsigned i;
+
+  snprintf(threads, sizeof(threads), "-n%u", thr);
+  snprintf(err, sizeof(err), "%s/%s.stats", corpus_dir, corpus);
+  argv[0] = (char *)"lbzip2";
+  argv[1] = threads;
+  argv[2] = (char *)(decompress ? "-dc" : "-c");
+  argv[3] = (char *)"--stats=json";
+  argv[4] = NULL;
+
+  for (i = 0u; i < repeat; ++i) {
+    t = run(argv, in, out, err);
+    s = slurp(err);
+    if (best < 0 || t < best) {
+      best = t;
+      free(stats);
+      stats = s;
+    }
+    else {
+      free(s);
+    }
+  }
+
+  report(corpus, size, thr, op, "total", best);
+  for (; *stages != NULL; ++stages)
+    report(corpus, size, thr, op, *stages, stage_time(stats, *stages));
+  fflush(stdout);
+  free(stats);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  const struct corpus *c;
+  size_t size = 16u << 20;
+  unsigned threads[32];
+  unsigned num_threads = 0u;
+  unsigned repeat = 3u;
+  unsigned i;
+  long ncpu;
+  char raw[256], zip[256], out[256];
+  int opt;
+  char *p;
+
+  while ((opt = getopt(argc, argv, "s:t:r:o:")) != -1) {
+    switch (opt) {
+    case 's':
+      size = strtoul(optarg, NULL, 10) << 20;
+      if (size == 0u)
+        b_error("invalid size: %s", optarg);
+      break;
+    case 't':
+      for (p = optarg; num_threads < 32u && *p != '\0'; p += *p == ',') {
+        threads[num_threads] = strtoul(p, &p, 10);
+        if (threads[num_threads++] == 0u || (*p != ',' && *p != '\0'))
+          b_error("invalid thread list: %s", optarg);
+      }
+      break;
+    case 'r':
+      repeat = strtoul(optarg, NULL, 10);
+      if (repeat == 0u)
+        b_error("invalid repeat count: %s", optarg);
+      break;
+    case 'o':
+      if (freopen(optarg, "w", stdout) == NULL)
+        b_error("unable to open %s: %s", optarg, strerror(errno));
+      break;
+    default:
+      b_error("usage: bench [-s MIB] [-t THREADS,...] [-r REPEAT] [-o CSV]");
+    }
+  }
+
+  /* By default measure 1, 2, 4, ... threads up to the number of CPUs. */
+  if (num_threads == 0u) {
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (i = 1u; i < (unsigned)ncpu && num_threads < 31u; i *= 2u)
+      threads[num_threads++] = i;
+    threads[num_threads++] = ncpu > 1 ? (unsigned)ncpu : 1u;
+  }
+
+  if (mkdir(corpus_dir, 0755) != 0 && errno != EEXIST)
+    b_error("unable to create directory %s: %s", corpus_dir, strerror(errno));
+
+  printf("corpus,bytes,threads,operation,stage,seconds,mb_per_s\n");
+
+  for (c = corpora; c->name != NULL; ++c) {
+    snprintf(raw, sizeof(raw), "%s/%s", corpus_dir, c->name);
+    snprintf(zip, sizeof(zip), "%s/%s.bz2", corpus_dir, c->name);
+    snprintf(out, sizeof(out), "%s/%s.out", corpus_dir, c->name);
+    make_corpus(c, size, raw);
+
+    for (i = 0u; i < num_threads; ++i) {
+      measure(c->name, size, threads[i], repeat, false, raw, zip);
+      measure(c->name, size, threads[i], repeat, true, zip, out);
+      compare(raw, out);
+    }
+
+    unlink(zip);
+    unlink(out);
+    snprintf(out, sizeof(out), "%s/%s.stats", corpus_dir, c->name);
+    unlink(out);
+  }
+
+  return 0;
+}
@@ -0,0 +1,183 @@
+/*-
+  corpus.c -- synthetic benchmark data
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "corpus.h"
+
+
+/* Deterministic pseudo-random number generator (xorshift64*), so that
+   corpora are the same on every machine. */
+static uint64_t rng_state;
+
+void
+rng_seed(uint64_t seed)
+{
+  rng_state = seed | 1u;
+}
+
+static uint32_t
+rng(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (rng_state * 0x2545F4914F6CDD1Du) >> 32;
+}
+
+
+/* English-like text: words drawn from a small vocabulary with a Zipf-like
+   distribution, with punctuation and line breaks. */
+static void
+gen_text(uint8_t *buf, size_t size)
+{
+  static const char *const words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was",
+    "with", "be", "by", "on", "not", "he", "this", "are", "or", "his",
+    "from", "at", "which", "but", "have", "an", "had", "they", "you",
+    "were", "their", "one", "all", "we", "can", "her", "has", "there",
+    "been", "if", "more", "when", "will", "would", "who", "so", "no",
+    "block", "stream", "thread", "worker", "buffer", "compress", "data",
+    "sorting", "transform", "Huffman", "selector", "symbol", "table",
+  };
+  static const size_t num_words = sizeof(words) / sizeof(*words);
+  size_t pos = 0u, col = 0u, len;
+  const char *w;
+
+  while (pos < size) {
+    /* Product of two uniform variables favours small indices. */
+    w = words[(size_t)rng() % num_words * (rng() % num_words) / num_words];
+    len = strlen(w);
+    if (col + len > 72u) {
+      buf[pos++] = '\n';
+      col = 0u;
+      continue;
+    }
+    if (size - pos < len + 1u)
+      len = size - pos - 1u;
+    memcpy(buf + pos, w, len);
+    pos += len;
+    col += len + 1u;
+    if (pos < size)
+      buf[pos++] = rng() % 16u == 0u ? ',' : ' ';
+  }
+}
+
+/* Incompressible data. */
+static void
+gen_random(uint8_t *buf, size_t size)
+{
+  size_t i;
+
+  for (i = 0u; i < size; ++i)
+    buf[i] = rng();
+}
+
+/* Fibonacci word, as in tests/fib.c. */
+static void
+gen_fib(uint8_t *buf, size_t size)
+{
+  uint8_t *p = buf, *q = buf, *r = buf + size;
+
+  *q++ = 'a';
+  while (q < r) {
+    if (*p++ == 'a' && q < r)
+      *q++ = 'b';
+    if (q < r)
+      *q++ = 'a';
+  }
+}
+
+/* Two alternating characters, as in tests/suite repet case. */
+static void
+gen_repet(uint8_t *buf, size_t size)
+{
+  size_t i;
+
+  for (i = 0u; i < size; ++i)
+    buf[i] = i % 2u ? 'b' : 'a';
+}
+
+/* Mostly zero bytes, with short runs of random bytes and small integers,
+   like a database file or an executable with large BSS-like regions. */
+static void
+gen_sparse(uint8_t *buf, size_t size)
+{
+  size_t i, n;
+
+  memset(buf, 0, size);
+  for (i = 0u; i < size; i += n) {
+    n = 16u + rng() % 256u;
+    if (i + 4u <= size && rng() % 4u == 0u) {
+      uint32_t v = rng() % 1000u;
+
+      memcpy(buf + i, &v, 4u);
+    }
+    else if (i < size) {
+      buf[i] = rng();
+    }
+  }
+}
+
+/* Tar-like archive: 512-byte headers followed by members of the other
+   kinds, padded to a multiple of 512 bytes. */
+static void
+gen_tar(uint8_t *buf, size_t size)
+{
+  static void (*const kinds[])(uint8_t *, size_t) = {
+    gen_text, gen_text, gen_sparse, gen_random,
+  };
+  size_t pos = 0u, len, hdr;
+  unsigned n = 0u;
+
+  while (pos < size) {
+    hdr = size - pos < 512u ? size - pos : 512u;
+    memset(buf + pos, 0, hdr);
+    if (hdr == 512u) {
+      len = 512u + rng() % (256u * 1024u);
+      snprintf((char *)buf + pos, 100, "dir/file%05u", n++);
+      snprintf((char *)buf + pos + 100, 8, "0000644");
+      snprintf((char *)buf + pos + 124, 12, "%011lo", (unsigned long)len);
+      memcpy(buf + pos + 257, "ustar", 5);
+    }
+    pos += hdr;
+    if (hdr < 512u)
+      break;
+
+    len = (len + 511u) / 512u * 512u;
+    if (len > size - pos)
+      len = size - pos;
+    kinds[rng() % 4u](buf + pos, len);
+    pos += len;
+  }
+}
+
+const struct corpus corpora[] = {
+  { "text",   gen_text   },
+  { "random", gen_random },
+  { "fib",    gen_fib    },
+  { "repet",  gen_repet  },
+  { "sparse", gen_sparse },
+  { "tar",    gen_tar    },
+  { NULL,     NULL       },
+};
@@ -0,0 +1,34 @@
+/*-
+  corpus.h -- synthetic benchmark data header
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* A kind of benchmark data. */
+struct corpus {
+  const char *name;
+  void (*generate)(uint8_t *buf, size_t size);
+};
+
+/* All kinds of data, ended by a null entry: text, random, fib, repet,
+   sparse and tar. */
+extern const struct corpus corpora[];
+
+/* Seed the generator used by corpora, so that the same data is generated
+   for the same seed on every machine. */
+void rng_seed(uint64_t seed);
@@ -39,6 +39,8 @@
 static const char *base_dir;
 static const char *suite_name;
 static const char *case_name;
+static const char *program = "./lbzip2";
+static const char *work_prefix = "work-";
 
 
 /* Like fprintf(stderr, ...), but _exits on failure. */
@@ -370,6 +372,11 @@ t_compare(const char *exp, const char *act)
   if (xfstat_size(act_fd) != size) {
     t_fail("files differ in size; expected: %s, actual: %s", exp, act);
   }
+  if (size == 0) {
+    xclose(exp_fd);
+    xclose(act_fd);
+    return;
+  }
   exp_ptr = xmmap(0, size, PROT_READ, MAP_SHARED, exp_fd, 0);
   act_ptr = xmmap(0, size, PROT_READ, MAP_SHARED, act_fd, 0);
 
@@ -403,7 +410,7 @@ test_compress(void)
 
   int status;
 
-  dir = t_concat("work-", suite_name, NULL);
+  dir = t_concat(work_prefix, suite_name, NULL);
   xmkdir(dir);
 
   in = t_concat(dir, "/", case_name, ".raw", NULL);
@@ -424,7 +431,7 @@ test_compress(void)
     }
     xrename(out, in);
   }
-  status = t_exec("./lbzip2", args, in, zout, err);
+  status = t_exec(program, args, in, zout, err);
   if (WIFSIGNALED(status)) {
     t_fail("lbzip2 was killed by signal %d (%s)", WTERMSIG(status),
            signal_name(WTERMSIG(status)));
@@ -482,7 +489,7 @@ test_expand(void)
 
   int status;
 
-  dir = t_concat("work-", suite_name, NULL);
+  dir = t_concat(work_prefix, suite_name, NULL);
   xmkdir(dir);
 
   bad = t_concat(dir, "/", case_name, ".bad", NULL);
@@ -514,7 +521,7 @@ test_expand(void)
       xclose(open_wr(bad));
     }
   }
-  status = t_exec("./lbzip2", args, zin, out, err);
+  status = t_exec(program, args, zin, out, err);
   if (WIFSIGNALED(status)) {
     t_fail("lbzip2 was killed by signal %d (%s)", WTERMSIG(status),
            signal_name(WTERMSIG(status)));
@@ -551,6 +558,556 @@ test_expand(void)
 }
 
 
+/* Write COPIES copies of a UNIT bytes long block of pseudo-random data to
+   given file.  No byte repeats the previous one, so initial RLE doesn't
+   change the data and copies of the block map to whole bzip2 blocks when
+   UNIT is a multiple of 100000. */
+static void
+t_generate(const char *fn, size_t unit, unsigned copies)
+{
+  unsigned char *buf;
+  unsigned long x = 1;
+  size_t i;
+  int fd;
+
+  buf = malloc(unit);
+  if (buf == NULL) {
+    t_error("out of memory");
+  }
+  for (i = 0; i < unit; i++) {
+    x = x * 1103515245 + 12345;
+    buf[i] = x >> 16;
+    if (i > 0 && buf[i] == buf[i - 1]) {
+      buf[i] ^= 1;
+    }
+  }
+
+  fd = open_wr(fn);
+  while (copies-- > 0) {
+    if (write(fd, buf, unit) != (ssize_t)unit) {
+      t_error("unable to write file: %s", fn);
+    }
+  }
+  xclose(fd);
+  free(buf);
+}
+
+
+/* Write SIZE bytes of pseudo-random runs of bytes to given file.  Runs are
+   up to 64 bytes long, so initial RLE shrinks the data and bzip2 blocks hold
+   more than the block size of input. */
+static void
+t_generate_runs(const char *fn, size_t size)
+{
+  unsigned char *buf;
+  unsigned long x = 1;
+  size_t i;
+  size_t n;
+  int fd;
+
+  buf = malloc(size);
+  if (buf == NULL) {
+    t_error("out of memory");
+  }
+  for (i = 0; i < size; i += n) {
+    x = x * 1103515245 + 12345;
+    n = (x >> 16) % 64 + 1;
+    if (n > size - i) {
+      n = size - i;
+    }
+    memset(buf + i, (int)(x >> 24) & 0xFF, n);
+  }
+
+  fd = open_wr(fn);
+  if (write(fd, buf, size) != (ssize_t)size) {
+    t_error("unable to write file: %s", fn);
+  }
+  xclose(fd);
+  free(buf);
+}
+
+
+/* Run lbzip2 with given arguments and fail test case unless it succeeds
+   without printing anything on standard error. */
+static void
+t_run(char *argv[], const char *in, const char *out)
+{
+  int fd;
+  char *err;
+  int status;
+
+  err = t_concat(out, ".err", NULL);
+  status = t_exec(program, argv, in, out, err);
+  if (WIFSIGNALED(status)) {
+    t_fail("lbzip2 was killed by signal %d (%s)", WTERMSIG(status),
+           signal_name(WTERMSIG(status)));
+  }
+  if (WEXITSTATUS(status) != 0) {
+    t_fail("lbzip2 failed with exit code %d", WEXITSTATUS(status));
+  }
+  fd = open_rd(err);
+  if (xfstat_size(fd) != 0) {
+    t_fail("lbzip2 printed message on standard error");
+  }
+  xclose(fd);
+  free(err);
+}
+
+
+/* Decompress given file with minbzcat and compare the result with the
+   expected file. */
+static void
+t_check_minbzcat(const char *zin, const char *exp)
+{
+  char *args[2] = {NULL, NULL};
+  char *out;
+  char *err;
+  int status;
+
+  out = t_concat(zin, ".out", NULL);
+  err = t_concat(zin, ".err", NULL);
+  status = t_exec("./minbzcat", args, zin, out, err);
+  if (WIFSIGNALED(status)) {
+    t_error("minbzcat was killed by signal %d (%s)",
+            WTERMSIG(status), signal_name(WTERMSIG(status)));
+  }
+  if (WEXITSTATUS(status) != 0) {
+    t_fail("minbzcat failed with exit code %d", WEXITSTATUS(status));
+  }
+  t_compare(exp, out);
+
+  free(out);
+  free(err);
+}
+
+
+/* Return the number of calls of given stage in the first statistics record
+   in given file, written by --stats=json. */
+static unsigned long
+t_stage_calls(const char *fn, const char *stage)
+{
+  const char *p;
+  char *text;
+  char *key;
+  char *s;
+  unsigned long calls;
+  off_t size;
+  int fd;
+
+  fd = open_rd(fn);
+  size = xfstat_size(fd);
+  if (size == 0) {
+    t_fail("no statistics were printed");
+  }
+  p = xmmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  text = malloc(size + 1);
+  if (text == NULL) {
+    t_error("out of memory");
+  }
+  memcpy(text, p, size);
+  text[size] = '\0';
+  xmunmap((void *)p, size);
+  xclose(fd);
+
+  key = t_concat("\"", stage, "\":{\"calls\":", NULL);
+  s = strstr(text, key);
+  if (s == NULL) {
+    t_fail("statistics don't include stage %s", stage);
+  }
+  calls = strtoul(s + strlen(key), NULL, 10);
+
+  free(key);
+  free(text);
+  return calls;
+}
+
+
+/* Check that --dedup doesn't change the output of compression of data
+   consisting of many identical blocks, and that it actually skips encoding
+   of the repeated blocks. */
+static void
+test_dedup(const char *dir)
+{
+  char *args_plain[5] = {NULL, "-1", "-n2", "-c", NULL};
+  char *args_dedup[6] = {NULL, "-1", "-n2", "-c", "--dedup", NULL};
+  char *args_stats[7] = {NULL, "-1", "-n2", "-c", "--dedup", "--stats=json",
+                         NULL};
+  char *args_expand[3] = {NULL, "-d", NULL};
+  unsigned long calls;
+  char *in;
+  char *zexp;
+  char *zout;
+  char *err;
+  char *out;
+  int status;
+
+  in = t_concat(dir, "/dedup.raw", NULL);
+  zexp = t_concat(dir, "/dedup.zexp", NULL);
+  zout = t_concat(dir, "/dedup.zout", NULL);
+  out = t_concat(dir, "/dedup.out", NULL);
+
+  t_generate(in, 200000, 12);
+  t_run(args_plain, in, zexp);
+  t_run(args_dedup, in, zout);
+  t_compare(zexp, zout);
+  t_run(args_expand, zout, out);
+  t_compare(in, out);
+  t_check_minbzcat(zout, in);
+
+  /* The input consists of 24 blocks, of which only two are different. */
+  err = t_concat(dir, "/dedup.stats", NULL);
+  status = t_exec(program, args_stats, in, zout, err);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    t_fail("lbzip2 --stats=json failed");
+  }
+  t_compare(zexp, zout);
+  calls = t_stage_calls(err, "encode");
+  if (calls >= 12) {
+    t_fail("%lu of 24 blocks were encoded with --dedup", calls);
+  }
+
+  free(in);
+  free(zexp);
+  free(zout);
+  free(err);
+  free(out);
+}
+
+
+/* Check that --parallel-files compresses several files to the same output
+   as sequential processing, and that the files decompress back to the
+   originals, also with --parallel-files.  Copies set to zero stand for a
+   file consisting of runs of UNIT bytes in total. */
+static void
+test_parallel_files(const char *dir)
+{
+  static const char *const names[] = {"a", "b", "c", "d", "e", "f"};
+  enum { NFILES = sizeof(names) / sizeof(names[0]) };
+  static const size_t units[NFILES] = {100000, 1000, 0, 300000, 7, 3000000};
+  static const unsigned copies[NFILES] = {5, 1000, 0, 2, 50000, 0};
+  char *seq_args[NFILES + 5];
+  char *par_args[NFILES + 5];
+  char *exp_args[NFILES + 6];
+  char *seq_dir;
+  char *par_dir;
+  char *seq[NFILES];
+  char *par[NFILES];
+  char *zseq[NFILES];
+  char *zpar[NFILES];
+  char *out;
+  unsigned i;
+
+  seq_dir = t_concat(dir, "/parallel-files-seq", NULL);
+  par_dir = t_concat(dir, "/parallel-files-par", NULL);
+  out = t_concat(dir, "/parallel-files.out", NULL);
+  xmkdir(seq_dir);
+  xmkdir(par_dir);
+
+  seq_args[1] = "-k";
+  seq_args[2] = "-f";
+  seq_args[3] = "-n2";
+  par_args[1] = "-f";
+  par_args[2] = "-n2";
+  par_args[3] = "--parallel-files";
+  exp_args[1] = "-d";
+  exp_args[2] = "-f";
+  exp_args[3] = "-n2";
+  exp_args[4] = "--parallel-files";
+
+  for (i = 0; i < NFILES; i++) {
+    seq[i] = t_concat(seq_dir, "/", names[i], NULL);
+    par[i] = t_concat(par_dir, "/", names[i], NULL);
+    zseq[i] = t_concat(seq[i], ".bz2", NULL);
+    zpar[i] = t_concat(par[i], ".bz2", NULL);
+    if (units[i] == 0) {
+      xclose(open_wr(seq[i]));
+      xclose(open_wr(par[i]));
+    }
+    else if (copies[i] == 0) {
+      t_generate_runs(seq[i], units[i]);
+      t_generate_runs(par[i], units[i]);
+    }
+    else {
+      t_generate(seq[i], units[i], copies[i]);
+      t_generate(par[i], units[i], copies[i]);
+    }
+    seq_args[4 + i] = seq[i];
+    par_args[4 + i] = par[i];
+    exp_args[5 + i] = zpar[i];
+  }
+  seq_args[4 + NFILES] = NULL;
+  par_args[4 + NFILES] = NULL;
+  exp_args[5 + NFILES] = NULL;
+
+  t_run(seq_args, "/dev/null", out);
+  t_run(par_args, "/dev/null", out);
+  for (i = 0; i < NFILES; i++) {
+    if (file_exists(par[i])) {
+      t_fail("original file was not removed: %s", par[i]);
+    }
+    t_compare(zseq[i], zpar[i]);
+  }
+
+  t_run(exp_args, "/dev/null", out);
+  for (i = 0; i < NFILES; i++) {
+    if (file_exists(zpar[i])) {
+      t_fail("compressed file was not removed: %s", zpar[i]);
+    }
+    t_compare(seq[i], par[i]);
+  }
+
+  for (i = 0; i < NFILES; i++) {
+    free(seq[i]);
+    free(par[i]);
+    free(zseq[i]);
+    free(zpar[i]);
+  }
+  free(seq_dir);
+  free(par_dir);
+  free(out);
+}
+
+
+/* Remove file if it exists, bail out on other failures. */
+static void
+t_remove(const char *path)
+{
+  if (unlink(path) != 0 && errno != ENOENT) {
+    t_error("Unable to remove file %s", path);
+  }
+}
+
+
+/* Check that given file exists or not, as expected. */
+static void
+t_expect_file(const char *path, int exists)
+{
+  if (file_exists(path) != exists) {
+    t_fail(exists ? "file is missing: %s" : "unexpected file: %s", path);
+  }
+}
+
+
+/* Check that -r processes every regular file in a directory tree exactly
+   once, ignores symbolic links, and keeps or removes the originals according
+   to -k, both when compressing and when decompressing. */
+static void
+test_recursive(const char *dir)
+{
+  static const char *const names[] = {
+    "f1", "sub/f2", "sub/deep/f3", "sub/deep/f4"
+  };
+  enum { NFILES = sizeof(names) / sizeof(names[0]) };
+  static const size_t units[NFILES] = {1000, 200000, 13, 0};
+  static const unsigned copies[NFILES] = {300, 2, 1000, 0};
+  char *args[6] = {NULL, "-n2", NULL, NULL, NULL, NULL};
+  char *root;
+  char *path[NFILES];
+  char *zpath[NFILES];
+  char *ref[NFILES];
+  char *outside;
+  char *file_link;
+  char *dir_link;
+  char *out;
+  char *tmp;
+  unsigned i;
+
+  root = t_concat(dir, "/recursive", NULL);
+  outside = t_concat(dir, "/recursive-outside", NULL);
+  file_link = t_concat(root, "/link", NULL);
+  dir_link = t_concat(root, "/sub/dlink", NULL);
+  out = t_concat(dir, "/recursive.out", NULL);
+
+  xmkdir(root);
+  tmp = t_concat(root, "/sub", NULL);
+  xmkdir(tmp);
+  free(tmp);
+  tmp = t_concat(root, "/sub/deep", NULL);
+  xmkdir(tmp);
+  free(tmp);
+
+  for (i = 0; i < NFILES; i++) {
+    path[i] = t_concat(root, "/", names[i], NULL);
+    zpath[i] = t_concat(path[i], ".bz2", NULL);
+    ref[i] = t_concat(dir, "/recursive-ref-", xbasename(names[i]), NULL);
+    t_remove(zpath[i]);
+    if (units[i] == 0) {
+      xclose(open_wr(path[i]));
+      xclose(open_wr(ref[i]));
+    }
+    else {
+      t_generate(path[i], units[i], copies[i]);
+      t_generate(ref[i], units[i], copies[i]);
+    }
+  }
+
+  /* Symbolic links to a file outside of the tree, and to a directory of the
+     tree, which would make its files processed twice if followed. */
+  t_generate(outside, 1000, 10);
+  tmp = t_concat(outside, ".bz2", NULL);
+  t_remove(tmp);
+  t_remove(file_link);
+  t_remove(dir_link);
+  if (symlink("../recursive-outside", file_link) != 0
+      || symlink(".", dir_link) != 0) {
+    t_error("Unable to create symbolic link");
+  }
+
+  /* Compress, keeping the originals. */
+  args[2] = "-r";
+  args[3] = "-k";
+  args[4] = root;
+  t_run(args, "/dev/null", out);
+  for (i = 0; i < NFILES; i++) {
+    t_expect_file(path[i], 1);
+    t_expect_file(zpath[i], 1);
+  }
+  t_expect_file(tmp, 0);
+  free(tmp);
+  tmp = t_concat(file_link, ".bz2", NULL);
+  t_expect_file(tmp, 0);
+  free(tmp);
+
+  /* Decompress, removing the compressed files. */
+  for (i = 0; i < NFILES; i++) {
+    xunlink(path[i]);
+  }
+  args[2] = "-d";
+  args[3] = "-r";
+  t_run(args, "/dev/null", out);
+  for (i = 0; i < NFILES; i++) {
+    t_expect_file(zpath[i], 0);
+    t_compare(ref[i], path[i]);
+  }
+
+  /* Compress, removing the originals. */
+  args[2] = "-r";
+  args[3] = root;
+  args[4] = NULL;
+  t_run(args, "/dev/null", out);
+  for (i = 0; i < NFILES; i++) {
+    t_expect_file(path[i], 0);
+    t_expect_file(zpath[i], 1);
+  }
+
+  /* Decompress, keeping the compressed files. */
+  args[2] = "-d";
+  args[3] = "-rk";
+  args[4] = root;
+  t_run(args, "/dev/null", out);
+  for (i = 0; i < NFILES; i++) {
+    t_expect_file(zpath[i], 1);
+    t_compare(ref[i], path[i]);
+  }
+
+  for (i = 0; i < NFILES; i++) {
+    free(path[i]);
+    free(zpath[i]);
+    free(ref[i]);
+  }
+  free(root);
+  free(outside);
+  free(file_link);
+  free(dir_link);
+  free(out);
+}
+
+
+/* Return the number of bzip2 stream headers, followed by a block header, at
+   byte offsets of given file. */
+static unsigned
+t_count_streams(const char *fn)
+{
+  static const char magic[] = "BZh11AY&SY";
+  const unsigned char *p;
+  unsigned count = 0;
+  off_t size;
+  off_t i;
+  int fd;
+
+  fd = open_rd(fn);
+  size = xfstat_size(fd);
+  if (size < (off_t)sizeof(magic) - 1) {
+    xclose(fd);
+    return 0;
+  }
+  p = xmmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  for (i = 0; i + (off_t)sizeof(magic) - 1 <= size; i++) {
+    if (memcmp(p + i, magic, sizeof(magic) - 1) == 0) {
+      count++;
+    }
+  }
+  xmunmap((void *)p, size);
+  xclose(fd);
+
+  return count;
+}
+
+
+/* Check that --stream-blocks splits output into the expected number of
+   streams, which decompress to the original data with both lbzip2 and
+   minbzcat. */
+static void
+test_stream_blocks(const char *dir)
+{
+  char *args_compress[6] = {NULL, "-1", "-n2", "-c", "--stream-blocks=2",
+                            NULL};
+  char *args_expand[3] = {NULL, "-d", NULL};
+  char *in;
+  char *zout;
+  char *out;
+  unsigned streams;
+
+  in = t_concat(dir, "/stream-blocks.raw", NULL);
+  zout = t_concat(dir, "/stream-blocks.zout", NULL);
+  out = t_concat(dir, "/stream-blocks.out", NULL);
+
+  /* Five 100k blocks, that is streams of 2, 2 and 1 blocks. */
+  t_generate(in, 100000, 5);
+  t_run(args_compress, in, zout);
+  streams = t_count_streams(zout);
+  if (streams != 3) {
+    t_fail("expected 3 streams, found %u", streams);
+  }
+  t_run(args_expand, zout, out);
+  t_compare(in, out);
+  t_check_minbzcat(zout, in);
+
+  free(in);
+  free(zout);
+  free(out);
+}
+
+
+/* Run test case exercising a command line option. */
+static void
+test_option(void)
+{
+  char *dir;
+
+  dir = t_concat(work_prefix, suite_name, NULL);
+  xmkdir(dir);
+
+  if (strcmp(case_name, "dedup") == 0) {
+    test_dedup(dir);
+  }
+  else if (strcmp(case_name, "parallel-files") == 0) {
+    test_parallel_files(dir);
+  }
+  else if (strcmp(case_name, "recursive") == 0) {
+    test_recursive(dir);
+  }
+  else if (strcmp(case_name, "stream-blocks") == 0) {
+    test_stream_blocks(dir);
+  }
+  else {
+    t_error("unknown option test case: %s", case_name);
+  }
+
+  free(dir);
+}
+
+
 /* Run specified test suite. */
 int
 main(int argc, char **argv)
@@ -572,6 +1129,19 @@ main(int argc, char **argv)
   else if (strcmp(mode, "expand") == 0) {
     test_handler = test_expand;
   }
+  else if (strcmp(mode, "option") == 0) {
+    test_handler = test_option;
+  }
+  else if (strcmp(mode, "lib-compress") == 0) {
+    test_handler = test_compress;
+    program = "./libfilter";
+    work_prefix = "work-lib-";
+  }
+  else if (strcmp(mode, "lib-expand") == 0) {
+    test_handler = test_expand;
+    program = "./libfilter";
+    work_prefix = "work-lib-";
+  }
   else {
     t_error("unknown test mode: %s", mode);
   }
@@ -0,0 +1,145 @@
+/*-
+  forktest.c -- check that liblbzip2 can be used after fork()
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* `forktest' compresses and decompresses a buffer, which leaves the private
+   worker pool of the closed contexts kept for reuse, then forks.  The child
+   process, which inherits the kept pool but none of its threads, does the
+   same round trip again.  It must finish instead of waiting forever for the
+   missing workers; an alarm turns a hang into a failure. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "liblbzip2.h"
+
+#define PLAIN_SIZE 300000
+#define THREADS 2
+
+
+static void
+fail(const char *msg)
+{
+  fprintf(stderr, "forktest: %s\n", msg);
+  exit(1);
+}
+
+/* Push all of IN to CTX and pull all of its output into OUT, which has room
+   for *SIZE bytes.  Store the size of the output in *SIZE. */
+static void
+run(struct lbzip2_ctx *ctx, const char *in, size_t in_size, char *out,
+    size_t *size)
+{
+  size_t n, vacant = *size;
+  int rv;
+
+  if (ctx == NULL)
+    fail("unable to create context");
+
+  while (in_size > 0) {
+    n = in_size;
+    if (lbzip2_push(ctx, in, &n) != LBZIP2_OK)
+      fail("push failed");
+    in += n;
+    in_size -= n;
+    do {
+      n = vacant;
+      rv = lbzip2_pull(ctx, out, &n);
+      out += n;
+      vacant -= n;
+    } while (rv == LBZIP2_OK && n > 0);
+    if (rv < 0)
+      fail("pull failed");
+  }
+
+  if (lbzip2_finish(ctx) != LBZIP2_OK)
+    fail("finish failed");
+  do {
+    n = vacant;
+    rv = lbzip2_pull(ctx, out, &n);
+    out += n;
+    vacant -= n;
+    if (rv == LBZIP2_OK && n == 0 && vacant == 0)
+      fail("output buffer too small");
+  } while (rv == LBZIP2_OK);
+  if (rv < 0)
+    fail("pull failed");
+
+  lbzip2_close(ctx);
+  *size -= vacant;
+}
+
+/* Compress and decompress PLAIN and check that the result is the same. */
+static void
+round_trip(const char *plain)
+{
+  static char packed[2 * PLAIN_SIZE];
+  static char unpacked[PLAIN_SIZE + 1];
+  size_t packed_size = sizeof(packed);
+  size_t unpacked_size = sizeof(unpacked);
+
+  run(lbzip2_compress_init(THREADS, 1), plain, PLAIN_SIZE, packed,
+      &packed_size);
+  run(lbzip2_decompress_init(THREADS), packed, packed_size, unpacked,
+      &unpacked_size);
+  if (unpacked_size != PLAIN_SIZE || memcmp(plain, unpacked, PLAIN_SIZE) != 0)
+    fail("decompressed data differs");
+}
+
+int
+main(void)
+{
+  static char plain[PLAIN_SIZE];
+  unsigned long x = 1;
+  pid_t pid;
+  int status;
+  size_t i;
+
+  for (i = 0; i < PLAIN_SIZE; i++) {
+    x = x * 1103515245 + 12345;
+    plain[i] = "abcdefgh"[(x >> 16) & 7];
+  }
+
+  round_trip(plain);
+
+  pid = fork();
+  if (pid == -1)
+    fail("fork failed");
+  if (pid == 0) {
+    alarm(60);
+    round_trip(plain);
+    _exit(0);
+  }
+
+  if (waitpid(pid, &status, 0) != pid)
+    fail("waitpid failed");
+  if (WIFSIGNALED(status))
+    fail(WTERMSIG(status) == SIGALRM ? "child process hung" :
+         "child process was killed");
+  if (WEXITSTATUS(status) != 0)
+    fail("child process failed");
+
+  round_trip(plain);
+  return 0;
+}
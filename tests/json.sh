@@ -0,0 +1,40 @@
+#!/bin/sh
+# Check that --stats=json and --trace= write valid JSON.
+# Usage: json.sh PYTHON stats|trace
+
+set -e
+
+python=$1
+dir=work-option
+mkdir -p $dir
+
+# A file name that isn't valid UTF-8 must still give valid JSON.
+in=$dir/json-$(printf '\351')
+cp ./lbzip2 "$in"
+rm -f "$in.bz2" "$in-2" "$in-2.bz2"
+
+case $2 in
+stats)
+  out=$dir/stats.json
+  ./lbzip2 -n2 -kf --stats=json "$in" 2> $out
+  ./lbzip2 -n2 -dc --stats=json < "$in.bz2" 2>> $out > /dev/null
+  cp "$in" "$in-2"
+  # --parallel-files gives way to --stats=json, and says so.
+  ./lbzip2 -n2 -kf --parallel-files --stats=json "$in" "$in-2" 2> $dir/stderr
+  grep -q 'one at a time' $dir/stderr
+  grep '^{' $dir/stderr >> $out
+  test "$(wc -l < $out)" -eq 7
+  $python -m json.tool --json-lines $out > /dev/null
+  ;;
+trace)
+  out=$dir/trace.json
+  ./lbzip2 -n2 -c --trace=$out < "$in" > "$in.bz2"
+  $python -m json.tool $out > /dev/null
+  ./lbzip2 -n2 -dc --trace=$out < "$in.bz2" > /dev/null
+  $python -m json.tool $out > /dev/null
+  ;;
+*)
+  echo "unknown test: $2" >&2
+  exit 2
+  ;;
+esac
@@ -0,0 +1,467 @@
+/*-
+  kbench.c -- microbenchmarks of compression and decompression kernels
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Usage: kbench [-b 1..9] [-k KIND] [-r REPEAT] [KERNEL...]
+
+  Call individual kernels directly on a single preloaded block of data of
+  the given KIND (one of the corpora of tests/corpus.c, all of them by
+  default) and size (-b, 900k by default), in a single thread.  Kernels are:
+
+    collect   initial RLE and block collection
+    divbwt    Burrows-Wheeler transform
+    prefix    prefix code generation, on the MTF values of the block
+    encode    whole block encoding: BWT, MTF and prefix code generation
+    transmit  writing of the encoded block
+    scan      searching the bitstream for the next block header
+    retrieve  reading of the encoded block
+    decode    inverse BWT setup
+    emit      inverse BWT and RLE, and CRC computation
+
+  Every kernel is run REPEAT times (10 by default) and the fastest run is
+  reported, as CSV on standard output.  Costs are given per byte of
+  uncompressed data, except for scan, which is given per byte of compressed
+  data.  Cycles and instructions are counted with perf_event_open(2) where
+  it is available; otherwise these columns are left empty.
+
+  The cost of MTF alone is the difference between encode, and divbwt plus
+  prefix.
+*/
+
+#include "common.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+#endif
+
+#include "encode.h"
+#include "decode.h"
+#include "corpus.h"
+
+
+struct counters {
+  double nsec;
+  uint64_t cycles;
+  uint64_t instructions;
+};
+
+static int cycles_fd = -1;
+static int instructions_fd = -1;
+
+
+static void
+k_error(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "kbench: ");
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fprintf(stderr, "\n");
+
+  exit(2);
+}
+
+
+/* The kernels allocate memory with xmalloc(), which is normally provided by
+   the program using them. */
+void *
+xmalloc(size_t size)
+{
+  void *p = malloc(size);
+
+  if (p == NULL)
+    k_error("out of memory");
+
+  return p;
+}
+
+
+static int
+open_counter(uint64_t config)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  (void)config;
+  return -1;
+#endif
+}
+
+
+static void
+init_counters(void)
+{
+#ifdef __linux__
+  cycles_fd = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+  instructions_fd = open_counter(PERF_COUNT_HW_INSTRUCTIONS);
+#endif
+  if (cycles_fd == -1)
+    fprintf(stderr, "kbench: hardware counters unavailable, "
+            "reporting time only\n");
+}
+
+
+static uint64_t
+read_counter(int fd)
+{
+  uint64_t val = 0u;
+
+  if (fd != -1 && read(fd, &val, sizeof(val)) != sizeof(val))
+    val = 0u;
+
+  return val;
+}
+
+
+static void
+sample(struct counters *c)
+{
+  struct timespec ts;
+
+  c->cycles = read_counter(cycles_fd);
+  c->instructions = read_counter(instructions_fd);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  c->nsec = ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* Measurement of one kernel, keeping the fastest of repeated runs. */
+struct timing {
+  struct counters start;
+  struct counters best;
+  bool valid;
+};
+
+static void
+t_begin(struct timing *t)
+{
+  sample(&t->start);
+}
+
+static void
+t_end(struct timing *t)
+{
+  struct counters now;
+
+  sample(&now);
+  now.nsec -= t->start.nsec;
+  now.cycles -= t->start.cycles;
+  now.instructions -= t->start.instructions;
+
+  if (!t->valid || now.nsec < t->best.nsec)
+    t->best = now;
+  t->valid = true;
+}
+
+
+static void
+report(const char *kernel, const char *kind, unsigned bs100k, size_t bytes,
+       const struct timing *t)
+{
+  printf("%s,%s,%u,%zu,%.3f,%.2f", kernel, kind, bs100k, bytes,
+         t->best.nsec / bytes, bytes / t->best.nsec * 1e3);
+  if (cycles_fd != -1)
+    printf(",%.3f", (double)t->best.cycles / bytes);
+  else
+    printf(",");
+  if (instructions_fd != -1 && t->best.cycles > 0u)
+    printf(",%.3f", (double)t->best.instructions / t->best.cycles);
+  else
+    printf(",");
+  printf("\n");
+  fflush(stdout);
+}
+
+
+static bool
+selected(char **kernels, const char *name)
+{
+  if (*kernels == NULL)
+    return true;
+  for (; *kernels != NULL; ++kernels) {
+    if (strcmp(*kernels, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+
+static void
+bench_kind(const struct corpus *c, unsigned bs100k, unsigned repeat,
+           char **kernels)
+{
+  unsigned long mbs = bs100k * 100000ul;
+  size_t alloc = encoder_alloc_size(mbs);
+  size_t in_size, avail, n, plain_size, out_size, size, emitted, vacant;
+  struct encoder_state *enc, *snap;
+  struct timing t;
+  const uint8_t *block;
+  uint8_t *in, *T, *out, *stream, *plain;
+  int32_t *SA, *bucket;
+  uint32_t crc, *words;
+  struct parser_state par;
+  struct header hdr;
+  struct bitstream bs0, bs;
+  struct decoder_state ds;
+  unsigned garbage, i;
+  int rv;
+
+  /* RLE may shrink the input a lot, so generate plenty of it. */
+  in_size = 64u * mbs;
+  in = xmalloc(in_size);
+  rng_seed(mbs ^ (uint64_t)c->name[0] << 32);
+  c->generate(in, in_size);
+
+  /* Collect one block. */
+  enc = xmalloc(alloc);
+  snap = xmalloc(alloc);
+  memset(&t, 0, sizeof(t));
+  for (i = 0u; i < repeat; ++i) {
+    encoder_init(enc, mbs, CLUSTER_FACTOR);
+    avail = in_size;
+    t_begin(&t);
+    (void)collect(enc, in, &avail);
+    t_end(&t);
+  }
+  block = encoder_block(enc, &n);
+  plain_size = in_size - avail;
+  if (selected(kernels, "collect"))
+    report("collect", c->name, bs100k, plain_size, &t);
+  memcpy(snap, enc, alloc);
+
+  /* BWT, on a copy of the block. */
+  if (selected(kernels, "divbwt")) {
+    T = xmalloc(n + 1u);
+    SA = xmalloc(n * sizeof(*SA));
+    bucket = xmalloc((65536u + 256u) * sizeof(*bucket));
+    memcpy(T, block, n);
+    memset(&t, 0, sizeof(t));
+    for (i = 0u; i < repeat; ++i) {
+      t_begin(&t);
+      (void)divbwt(T, SA, bucket, n);
+      t_end(&t);
+    }
+    report("divbwt", c->name, bs100k, plain_size, &t);
+    free(T);
+    free(SA);
+    free(bucket);
+  }
+
+  /* Prefix code generation consumes the symbol frequencies left by MTF, so
+     every run starts from a snapshot of the encoder taken after MTF. */
+  if (selected(kernels, "prefix")) {
+    struct encoder_state *mtf = xmalloc(alloc);
+
+    memcpy(enc, snap, alloc);
+    encode_mtf(enc);
+    memcpy(mtf, enc, alloc);
+    memset(&t, 0, sizeof(t));
+    for (i = 0u; i < repeat; ++i) {
+      memcpy(enc, mtf, alloc);
+      t_begin(&t);
+      (void)generate_prefix_code(enc);
+      t_end(&t);
+    }
+    report("prefix", c->name, bs100k, plain_size, &t);
+    free(mtf);
+  }
+
+  /* Encoding destroys the collected block, so every run starts from a
+     snapshot of the encoder.  An untimed first run sets out_size
+     regardless of the repeat count. */
+  memcpy(enc, snap, alloc);
+  out_size = encode(enc, &crc);
+  memset(&t, 0, sizeof(t));
+  for (i = 0u; i < repeat; ++i) {
+    memcpy(enc, snap, alloc);
+    t_begin(&t);
+    out_size = encode(enc, &crc);
+    t_end(&t);
+  }
+  if (selected(kernels, "encode"))
+    report("encode", c->name, bs100k, plain_size, &t);
+
+  /* Transmission doesn't change the encoder, so it can be repeated.  Build
+     a stream of two copies of the block, so that scan() has a block header
+     to find. */
+  size = (4u + 2u * out_size + TRANSMIT_SLACK + 3u) / 4u * 4u;
+  words = xmalloc(size);
+  stream = (uint8_t *)words;
+  out = xmalloc(out_size + TRANSMIT_SLACK);
+  memset(&t, 0, sizeof(t));
+  for (i = 0u; i < repeat; ++i) {
+    t_begin(&t);
+    (void)transmit(enc, out);
+    t_end(&t);
+  }
+  if (selected(kernels, "transmit"))
+    report("transmit", c->name, bs100k, plain_size, &t);
+
+  memset(stream, 0, size);
+  memcpy(stream, "BZh", 3u);
+  stream[3] = '0' + bs100k;
+  memcpy(stream + 4, out, out_size);
+  memcpy(stream + 4 + out_size, out, out_size);
+  size = (4u + 2u * out_size) / 4u * 4u;
+
+  /* Position a bitstream at the start of the first block. */
+  parser_init(&par, bs100k, 0);
+  bs0.live = 0u;
+  bs0.buff = 0u;
+  bs0.block = NULL;
+  bs0.data = words + 1;
+  bs0.limit = words + size / 4u;
+  bs0.eof = true;
+  if (parse(&par, &hdr, &bs0, &garbage) != OK)
+    k_error("%s: unable to parse encoded block", c->name);
+
+  if (selected(kernels, "scan")) {
+    memset(&t, 0, sizeof(t));
+    for (i = 0u; i < repeat; ++i) {
+      bs = bs0;
+      t_begin(&t);
+      rv = scan(&bs, 0u);
+      t_end(&t);
+      if (rv != OK)
+        k_error("%s: scan() didn't find the second block", c->name);
+    }
+    report("scan", c->name, bs100k, out_size, &t);
+  }
+
+  /* Retrieve, decode and emit the block in turn. */
+  plain = xmalloc(in_size);
+  {
+    struct timing tr, td, te;
+
+    memset(&tr, 0, sizeof(tr));
+    memset(&td, 0, sizeof(td));
+    memset(&te, 0, sizeof(te));
+    emitted = 0u;
+
+    for (i = 0u; i < repeat; ++i) {
+      bs = bs0;
+      decoder_init(&ds);
+      t_begin(&tr);
+      rv = retrieve(&ds, &bs);
+      t_end(&tr);
+      if (rv != OK)
+        k_error("%s: retrieve() failed: %s", c->name, err2str(rv));
+
+      t_begin(&td);
+      decode(&ds);
+      t_end(&td);
+
+      vacant = in_size;
+      t_begin(&te);
+      rv = emit(&ds, plain, &vacant);
+      t_end(&te);
+      if (rv != OK || ds.crc != hdr.crc)
+        k_error("%s: emit() failed", c->name);
+      emitted = in_size - vacant;
+      decoder_free(&ds);
+    }
+
+    if (emitted != plain_size || memcmp(plain, in, emitted) != 0)
+      k_error("%s: decoded block differs from input", c->name);
+
+    if (selected(kernels, "retrieve"))
+      report("retrieve", c->name, bs100k, emitted, &tr);
+    if (selected(kernels, "decode"))
+      report("decode", c->name, bs100k, emitted, &td);
+    if (selected(kernels, "emit"))
+      report("emit", c->name, bs100k, emitted, &te);
+  }
+
+  free(plain);
+  free(out);
+  free(words);
+  free(snap);
+  free(enc);
+  free(in);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  const struct corpus *c;
+  const char *kind = NULL;
+  unsigned bs100k = 9u;
+  unsigned repeat = 10u;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:k:r:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bs100k = strtoul(optarg, NULL, 10);
+      if (bs100k < 1u || bs100k > 9u)
+        k_error("invalid block size: %s", optarg);
+      break;
+    case 'k':
+      kind = optarg;
+      break;
+    case 'r':
+      repeat = strtoul(optarg, NULL, 10);
+      if (repeat == 0u)
+        k_error("invalid repeat count: %s", optarg);
+      break;
+    default:
+      k_error("usage: kbench [-b 1..9] [-k KIND] [-r REPEAT] [KERNEL...]");
+    }
+  }
+
+  for (c = corpora; kind != NULL && c->name != NULL; ++c) {
+    if (strcmp(kind, c->name) == 0)
+      break;
+  }
+  if (kind != NULL && c->name == NULL)
+    k_error("unknown kind of data: %s", kind);
+
+  init_counters();
+
+  printf("kernel,kind,bs100k,bytes,ns_per_byte,mb_per_s,cycles_per_byte,"
+         "ipc\n");
+
+  for (c = corpora; c->name != NULL; ++c) {
+    if (kind == NULL || strcmp(kind, c->name) == 0)
+      bench_kind(c, bs100k, repeat, argv + optind);
+  }
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+/*-
+  libfilter.c -- liblbzip2 test filter
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* `libfilter' compresses stdin to stdout using liblbzip2, or decompresses it
+   if the -d option is given.  It behaves like `lbzip2' and `lbzip2 -d' as far
+   as the test driver is concerned: exit status is 1 and a message is printed
+   on stderr if compressed data is invalid.
+
+   Input is pushed in pieces of odd size so that words and blocks straddle
+   push boundaries. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "liblbzip2.h"
+
+
+static struct lbzip2_ctx *ctx;
+static char obuf[65536];
+
+
+static void
+fail(const char *msg)
+{
+  fprintf(stderr, "libfilter: %s\n", msg);
+  exit(msg != NULL && strncmp(msg, "compressed data error", 21) == 0 ? 1 : 2);
+}
+
+static void
+xwrite(const char *buf, size_t size)
+{
+  ssize_t wr;
+
+  while (size > 0) {
+    wr = write(STDOUT_FILENO, buf, size);
+    if (wr <= 0)
+      fail("write error");
+    buf += wr;
+    size -= wr;
+  }
+}
+
+/* Pull all output that is ready.  Return nonzero at end of output. */
+static int
+drain(void)
+{
+  size_t size;
+  int rv;
+
+  do {
+    size = sizeof(obuf);
+    rv = lbzip2_pull(ctx, obuf, &size);
+    if (rv < 0) {
+      static char msg[256];
+
+      snprintf(msg, sizeof(msg), "compressed data error: %s",
+               lbzip2_error(ctx));
+      fail(msg);
+    }
+    xwrite(obuf, size);
+  } while (rv == LBZIP2_OK && size > 0);
+
+  return rv == LBZIP2_END;
+}
+
+int
+main(int argc, char **argv)
+{
+  static char ibuf[32749];
+  ssize_t rd;
+  size_t size;
+  char *p;
+
+  if (argc > 1 && strcmp(argv[1], "-d") == 0)
+    ctx = lbzip2_decompress_init(3);
+  else
+    ctx = lbzip2_compress_init(3, 9);
+  if (ctx == NULL)
+    fail("unable to create context");
+
+  while ((rd = read(STDIN_FILENO, ibuf, sizeof(ibuf))) > 0) {
+    p = ibuf;
+    while (rd > 0) {
+      size = rd;
+      if (lbzip2_push(ctx, p, &size) != LBZIP2_OK)
+        fail("push failed");
+      p += size;
+      rd -= size;
+      (void)drain();
+    }
+  }
+  if (rd < 0)
+    fail("read error");
+
+  if (lbzip2_finish(ctx) != LBZIP2_OK)
+    fail("finish failed");
+  while (!drain())
+    ;
+
+  lbzip2_close(ctx);
+  return 0;
+}
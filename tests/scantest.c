@@ -0,0 +1,148 @@
+/*-
+  scantest.c -- check that the block header scanner doesn't skip headers
+
+  Copyright (C) 2026 Mikolaj Izdebski
+
+  This file is part of lbzip2.
+
+  lbzip2 is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  lbzip2 is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with lbzip2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* `scantest' encodes a block and places it in a bitstream right after a
+   false block magic, followed by an implausible header, so that the real
+   block magic overlaps the false match: either the last three bits of the
+   false magic, which are also the first three bits of the magic, or any bit
+   of the 32-bit CRC that follows the false magic.  scan() must reject the
+   false match and find the real header. */
+
+#include "common.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "encode.h"
+#include "decode.h"
+
+#define PLAIN_SIZE 10000u
+#define MAGIC_BITS 48u
+#define CRC_BITS 32u
+
+
+static void
+fail(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "scantest: ");
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fprintf(stderr, "\n");
+
+  exit(1);
+}
+
+
+/* The kernels allocate memory with xmalloc(), which is normally provided by
+   the program using them. */
+void *
+xmalloc(size_t size)
+{
+  void *p = malloc(size);
+
+  if (p == NULL)
+    fail("out of memory");
+
+  return p;
+}
+
+
+/* Copy SIZE bytes of SRC to DST starting at bit offset POS. */
+static void
+put_bits(uint8_t *dst, size_t pos, const uint8_t *src, size_t size)
+{
+  size_t i;
+  unsigned bit;
+
+  for (i = 0u; i < 8u * size; ++i, ++pos) {
+    bit = (src[i / 8u] >> (7u - i % 8u)) & 1u;
+    dst[pos / 8u] &= ~(0x80u >> pos % 8u);
+    dst[pos / 8u] |= bit << (7u - pos % 8u);
+  }
+}
+
+
+int
+main(void)
+{
+  static const uint8_t magic[6] = {0x31, 0x41, 0x59, 0x26, 0x53, 0x59};
+  static uint8_t plain[PLAIN_SIZE];
+  struct encoder_state *enc;
+  struct bitstream bs;
+  uint32_t crc, *words;
+  uint8_t *block, *stream;
+  size_t left, block_size, num_words, offset, found;
+  unsigned long x = 1;
+  unsigned i;
+
+  for (i = 0u; i < PLAIN_SIZE; ++i) {
+    x = x * 1103515245 + 12345;
+    plain[i] = "abcdefgh"[(x >> 16) & 7];
+  }
+
+  enc = xmalloc(encoder_alloc_size(100000u));
+  encoder_init(enc, 100000u, CLUSTER_FACTOR);
+  left = PLAIN_SIZE;
+  (void)collect(enc, plain, &left);
+  block_size = encode(enc, &crc);
+  block = xmalloc(block_size + TRANSMIT_SLACK);
+  (void)transmit(enc, block);
+
+  num_words = (MAGIC_BITS + CRC_BITS + 8u * block_size + 31u) / 32u;
+  words = xmalloc(4u * num_words);
+  stream = (uint8_t *)words;
+
+  /* Offsets of the real block relative to the false match.  At offsets 46
+     and 47 the real magic would overwrite the false one. */
+  for (offset = MAGIC_BITS - 3u; offset < MAGIC_BITS + CRC_BITS; ++offset) {
+    if (offset == MAGIC_BITS - 2u)
+      offset = MAGIC_BITS;
+
+    memset(stream, 0, 4u * num_words);
+    put_bits(stream, 0u, magic, sizeof(magic));
+    put_bits(stream, offset, block, block_size);
+    if (memcmp(stream, magic, sizeof(magic)) != 0)
+      fail("bad test setup at offset %u", (unsigned)offset);
+
+    bs.live = 0u;
+    bs.buff = 0u;
+    bs.block = NULL;
+    bs.data = words;
+    bs.limit = words + num_words;
+    bs.eof = true;
+    if (scan(&bs, 0u) != OK)
+      fail("no block header found at offset %u", (unsigned)offset);
+
+    found = 32u * (size_t)(bs.data - words) - bs.live;
+    if (found != offset + MAGIC_BITS + CRC_BITS)
+      fail("block header at offset %u found at %u instead", (unsigned)offset,
+           (unsigned)(found - MAGIC_BITS - CRC_BITS));
+  }
+
+  free(words);
+  free(block);
+  free(enc);
+  return 0;
+}